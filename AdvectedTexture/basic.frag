@@ -3,6 +3,8 @@
 const int size = 1024;
 
 uniform sampler2D tex;
+//texture only holds R channel, replicate it to RGB
+uniform bool isMono;
 
 in perVert
 {
@@ -34,5 +36,7 @@ void main()
 {
 	vec2 tpos = vec2((pos.x + 1.0f)/2, (pos.y + 1.0f)/2);
 	FragColor = texture(tex, tpos);
+	if (isMono)
+		FragColor.rgb = FragColor.rrr;
 	FragColor.w = 1.0f;
 }
\ No newline at end of file
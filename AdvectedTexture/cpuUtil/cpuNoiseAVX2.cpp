@@ -0,0 +1,166 @@
+#include "cpuNoiseKernel.h"
+#include <immintrin.h>
+
+//compiled with /arch:AVX2, only called after runtime check.
+//every operation mirrors the scalar version in the same order, so results are identical
+namespace cpuu
+{
+namespace detail
+{
+namespace
+{
+
+inline __m256i mad24u(const __m256i a, const __m256i b, const __m256i c)
+{
+	const __m256i mask = _mm256_set1_epi32(0xffffff);
+	return _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)), c);
+}
+inline __m256i mad24i(const __m256i a, const __m256i b, const __m256i c)
+{
+	const __m256i sa = _mm256_srai_epi32(_mm256_slli_epi32(a, 8), 8), sb = _mm256_srai_epi32(_mm256_slli_epi32(b, 8), 8);
+	return _mm256_add_epi32(_mm256_mullo_epi32(sa, sb), c);
+}
+
+//no unsigned convert before AVX-512, both halves are exact so only the sum rounds
+inline __m256 toFloatU32(const __m256i n)
+{
+	const __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(n, 16)),
+		lo = _mm256_cvtepi32_ps(_mm256_and_si256(n, _mm256_set1_epi32(0xffff)));
+	return _mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.0f)), lo);
+}
+
+inline __m256 getNoise(const __m256i x, const __m256i y)
+{
+	const __m256i n = _mm256_add_epi32(mad24i(y, _mm256_set1_epi32(58), x), mad24i(x, _mm256_set1_epi32(4093), y));
+	const __m256i h = mad24u(n, mad24u(n, _mm256_mullo_epi32(n, _mm256_set1_epi32(15731)), _mm256_set1_epi32(789221)), _mm256_set1_epi32(1376312589));
+	return _mm256_mul_ps(toFloatU32(h), _mm256_set1_ps(1.0f / 4294967296.0f));
+}
+
+inline __m256 cosPi(const __m256 t)
+{
+	const __m256 isHi = _mm256_cmp_ps(t, _mm256_set1_ps(0.5f), _CMP_GT_OQ);
+	const __m256 tp = _mm256_blendv_ps(t, _mm256_sub_ps(_mm256_set1_ps(1.0f), t), isHi);
+	const __m256 z = _mm256_mul_ps(tp, tp);
+	__m256 c = _mm256_set1_ps(COSPI_C12);
+	c = _mm256_add_ps(_mm256_mul_ps(c, z), _mm256_set1_ps(COSPI_C10));
+	c = _mm256_add_ps(_mm256_mul_ps(c, z), _mm256_set1_ps(COSPI_C8));
+	c = _mm256_add_ps(_mm256_mul_ps(c, z), _mm256_set1_ps(COSPI_C6));
+	c = _mm256_add_ps(_mm256_mul_ps(c, z), _mm256_set1_ps(COSPI_C4));
+	c = _mm256_add_ps(_mm256_mul_ps(c, z), _mm256_set1_ps(COSPI_C2));
+	c = _mm256_add_ps(_mm256_mul_ps(c, z), _mm256_set1_ps(1.0f));
+	return _mm256_xor_ps(c, _mm256_and_ps(isHi, _mm256_set1_ps(-0.0f)));
+}
+
+inline __m256 interW(const __m256 t, const int interp)
+{
+	if (interp == 1)
+		return t;
+	if (interp == 2)
+		return _mm256_mul_ps(_mm256_mul_ps(t, t), _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_set1_ps(2.0f), t)));
+	return _mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(cosPi(t), _mm256_set1_ps(0.5f)));
+}
+
+inline __m256 mix(const __m256 a, const __m256 b, const __m256 w)
+{
+	return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), w));
+}
+
+//value of one octave at (rx, ry), weights are made by wfunc
+template<typename F>
+inline __m256 octave(const __m256 rx, const __m256 ry, F wfunc)
+{
+	const __m256 fx0 = _mm256_floor_ps(rx), fy0 = _mm256_floor_ps(ry);
+	const __m256i x0 = _mm256_cvttps_epi32(fx0), y0 = _mm256_cvttps_epi32(fy0),
+		x1 = _mm256_cvttps_epi32(_mm256_ceil_ps(rx)), y1 = _mm256_cvttps_epi32(_mm256_ceil_ps(ry));
+	const __m256 w00 = getNoise(x0, y0),
+		w10 = getNoise(x1, y0),
+		w01 = getNoise(x0, y1),
+		w11 = getNoise(x1, y1);
+	const __m256 wx = wfunc(_mm256_sub_ps(rx, fx0)), wy = wfunc(_mm256_sub_ps(ry, fy0));
+	return mix(mix(w00, w10, wx), mix(w01, w11, wx), wy);
+}
+
+inline __m256 stepNoise(const int level, const __m256 fx, const float fy)
+{
+	float stp = 1.0f;
+	for (int a = 0; a < level; ++a)
+		stp *= 0.5f;
+	return octave(_mm256_mul_ps(fx, _mm256_set1_ps(stp)), _mm256_set1_ps(fy * stp), [](const __m256 t)
+	{
+		return _mm256_add_ps(_mm256_mul_ps(cosPi(t), _mm256_set1_ps(-0.5f)), _mm256_set1_ps(0.5f));
+	});
+}
+
+inline __m256 multiNoise(const int level, const int interp, const __m256 fx, const float fy)
+{
+	__m256 val = _mm256_setzero_ps();
+	float stp = 1.0f, amp = 1.0f;
+	for (int a = 0; a < level; ++a)
+		amp *= 0.5f;
+	for (int a = level; a-- > 0; amp *= 2, stp *= 0.5f)
+	{
+		const __m256 oct = octave(_mm256_mul_ps(fx, _mm256_set1_ps(stp)), _mm256_set1_ps(fy * stp), [interp](const __m256 t)
+		{
+			return interW(t, interp);
+		});
+		val = _mm256_add_ps(val, _mm256_mul_ps(oct, _mm256_set1_ps(amp)));
+	}
+	return val;
+}
+
+inline void store(const NoiseParam & param, const size_t id, const __m256 val)
+{
+	switch (param.fmt)
+	{
+	case cpuNoise::Format::R32F:
+		_mm256_storeu_ps((float *)param.dst + id, val);
+		break;
+	case cpuNoise::Format::R16F:
+		_mm_storeu_si128((__m128i *)((uint16_t *)param.dst + id), _mm256_cvtps_ph(val, _MM_FROUND_TO_NEAREST_INT));
+		break;
+	case cpuNoise::Format::R8:
+	{
+		//round to nearest even, then saturate
+		const __m256i i32 = _mm256_cvtps_epi32(_mm256_mul_ps(val, _mm256_set1_ps(255.0f)));
+		const __m128i i16 = _mm_packs_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1));
+		_mm_storel_epi64((__m128i *)((uint8_t *)param.dst + id), _mm_packus_epi16(i16, i16));
+		break;
+	}
+	default:
+	{
+		alignas(32) float vals[8];
+		_mm256_store_ps(vals, val);
+		float * dst = (float *)param.dst + id * 4;
+		for (int a = 0; a < 8; ++a, dst += 4)
+		{
+			dst[0] = dst[1] = dst[2] = vals[a];
+			dst[3] = 1.0f;
+		}
+		break;
+	}
+	}
+}
+
+}
+
+void rowAVX2(const NoiseParam & param, const uint32_t y, const uint32_t x0, const uint32_t x1)
+{
+	uint32_t x = x0;
+	//colorful is only a few divisions per pixel, leave it to scalar
+	if (param.mode != cpuNoise::Mode::Colorful)
+	{
+		const size_t base = (size_t)y * param.width;
+		const __m256 iota = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+		for (; x + 8 <= x1; x += 8)
+		{
+			const __m256 fx = _mm256_add_ps(_mm256_set1_ps((float)x), iota);
+			const __m256 val = param.mode == cpuNoise::Mode::Step ? stepNoise(param.level, fx, (float)y) : multiNoise(param.level, param.interp, fx, (float)y);
+			store(param, base + x, val);
+		}
+	}
+	if (x < x1)
+		rowScalar(param, y, x, x1);
+}
+
+}
+}
@@ -0,0 +1,162 @@
+#include "cpuNoiseKernel.h"
+#include <immintrin.h>
+
+//compiled with /arch:AVX512, only called after runtime check. intrinsics here are all AVX512F,
+//but the compiler may emit AVX512DQ/BW/VL for other code under that flag, so detectISA requires all four(Skylake-SP baseline).
+//every operation mirrors the scalar version in the same order, so results are identical
+namespace cpuu
+{
+namespace detail
+{
+namespace
+{
+
+inline __m512i mad24u(const __m512i a, const __m512i b, const __m512i c)
+{
+	const __m512i mask = _mm512_set1_epi32(0xffffff);
+	return _mm512_add_epi32(_mm512_mullo_epi32(_mm512_and_si512(a, mask), _mm512_and_si512(b, mask)), c);
+}
+inline __m512i mad24i(const __m512i a, const __m512i b, const __m512i c)
+{
+	const __m512i sa = _mm512_srai_epi32(_mm512_slli_epi32(a, 8), 8), sb = _mm512_srai_epi32(_mm512_slli_epi32(b, 8), 8);
+	return _mm512_add_epi32(_mm512_mullo_epi32(sa, sb), c);
+}
+
+inline __m512 getNoise(const __m512i x, const __m512i y)
+{
+	const __m512i n = _mm512_add_epi32(mad24i(y, _mm512_set1_epi32(58), x), mad24i(x, _mm512_set1_epi32(4093), y));
+	const __m512i h = mad24u(n, mad24u(n, _mm512_mullo_epi32(n, _mm512_set1_epi32(15731)), _mm512_set1_epi32(789221)), _mm512_set1_epi32(1376312589));
+	return _mm512_mul_ps(_mm512_cvtepu32_ps(h), _mm512_set1_ps(1.0f / 4294967296.0f));
+}
+
+inline __m512 cosPi(const __m512 t)
+{
+	const __mmask16 isHi = _mm512_cmp_ps_mask(t, _mm512_set1_ps(0.5f), _CMP_GT_OQ);
+	const __m512 tp = _mm512_mask_blend_ps(isHi, t, _mm512_sub_ps(_mm512_set1_ps(1.0f), t));
+	const __m512 z = _mm512_mul_ps(tp, tp);
+	__m512 c = _mm512_set1_ps(COSPI_C12);
+	c = _mm512_add_ps(_mm512_mul_ps(c, z), _mm512_set1_ps(COSPI_C10));
+	c = _mm512_add_ps(_mm512_mul_ps(c, z), _mm512_set1_ps(COSPI_C8));
+	c = _mm512_add_ps(_mm512_mul_ps(c, z), _mm512_set1_ps(COSPI_C6));
+	c = _mm512_add_ps(_mm512_mul_ps(c, z), _mm512_set1_ps(COSPI_C4));
+	c = _mm512_add_ps(_mm512_mul_ps(c, z), _mm512_set1_ps(COSPI_C2));
+	c = _mm512_add_ps(_mm512_mul_ps(c, z), _mm512_set1_ps(1.0f));
+	//float xor needs AVX512DQ, flip sign bit as integer
+	const __m512i ci = _mm512_castps_si512(c);
+	return _mm512_castsi512_ps(_mm512_mask_xor_epi32(ci, isHi, ci, _mm512_set1_epi32((int)0x80000000)));
+}
+
+inline __m512 interW(const __m512 t, const int interp)
+{
+	if (interp == 1)
+		return t;
+	if (interp == 2)
+		return _mm512_mul_ps(_mm512_mul_ps(t, t), _mm512_sub_ps(_mm512_set1_ps(3.0f), _mm512_mul_ps(_mm512_set1_ps(2.0f), t)));
+	return _mm512_sub_ps(_mm512_set1_ps(0.5f), _mm512_mul_ps(cosPi(t), _mm512_set1_ps(0.5f)));
+}
+
+inline __m512 mix(const __m512 a, const __m512 b, const __m512 w)
+{
+	return _mm512_add_ps(a, _mm512_mul_ps(_mm512_sub_ps(b, a), w));
+}
+
+//value of one octave at (rx, ry), weights are made by wfunc
+template<typename F>
+inline __m512 octave(const __m512 rx, const __m512 ry, F wfunc)
+{
+	const __m512 fx0 = _mm512_roundscale_ps(rx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC),
+		fy0 = _mm512_roundscale_ps(ry, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	const __m512i x0 = _mm512_cvttps_epi32(fx0), y0 = _mm512_cvttps_epi32(fy0),
+		x1 = _mm512_cvttps_epi32(_mm512_roundscale_ps(rx, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC)),
+		y1 = _mm512_cvttps_epi32(_mm512_roundscale_ps(ry, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC));
+	const __m512 w00 = getNoise(x0, y0),
+		w10 = getNoise(x1, y0),
+		w01 = getNoise(x0, y1),
+		w11 = getNoise(x1, y1);
+	const __m512 wx = wfunc(_mm512_sub_ps(rx, fx0)), wy = wfunc(_mm512_sub_ps(ry, fy0));
+	return mix(mix(w00, w10, wx), mix(w01, w11, wx), wy);
+}
+
+inline __m512 stepNoise(const int level, const __m512 fx, const float fy)
+{
+	float stp = 1.0f;
+	for (int a = 0; a < level; ++a)
+		stp *= 0.5f;
+	return octave(_mm512_mul_ps(fx, _mm512_set1_ps(stp)), _mm512_set1_ps(fy * stp), [](const __m512 t)
+	{
+		return _mm512_add_ps(_mm512_mul_ps(cosPi(t), _mm512_set1_ps(-0.5f)), _mm512_set1_ps(0.5f));
+	});
+}
+
+inline __m512 multiNoise(const int level, const int interp, const __m512 fx, const float fy)
+{
+	__m512 val = _mm512_setzero_ps();
+	float stp = 1.0f, amp = 1.0f;
+	for (int a = 0; a < level; ++a)
+		amp *= 0.5f;
+	for (int a = level; a-- > 0; amp *= 2, stp *= 0.5f)
+	{
+		const __m512 oct = octave(_mm512_mul_ps(fx, _mm512_set1_ps(stp)), _mm512_set1_ps(fy * stp), [interp](const __m512 t)
+		{
+			return interW(t, interp);
+		});
+		val = _mm512_add_ps(val, _mm512_mul_ps(oct, _mm512_set1_ps(amp)));
+	}
+	return val;
+}
+
+inline void store(const NoiseParam & param, const size_t id, const __m512 val)
+{
+	switch (param.fmt)
+	{
+	case cpuNoise::Format::R32F:
+		_mm512_storeu_ps((float *)param.dst + id, val);
+		break;
+	case cpuNoise::Format::R16F:
+		_mm256_storeu_si256((__m256i *)((uint16_t *)param.dst + id), _mm512_cvtps_ph(val, _MM_FROUND_TO_NEAREST_INT));
+		break;
+	case cpuNoise::Format::R8:
+	{
+		//round to nearest even, clamp negative then saturate to 255
+		const __m512i i32 = _mm512_max_epi32(_mm512_cvtps_epi32(_mm512_mul_ps(val, _mm512_set1_ps(255.0f))), _mm512_setzero_si512());
+		_mm_storeu_si128((__m128i *)((uint8_t *)param.dst + id), _mm512_cvtusepi32_epi8(i32));
+		break;
+	}
+	default:
+	{
+		alignas(64) float vals[16];
+		_mm512_store_ps(vals, val);
+		float * dst = (float *)param.dst + id * 4;
+		for (int a = 0; a < 16; ++a, dst += 4)
+		{
+			dst[0] = dst[1] = dst[2] = vals[a];
+			dst[3] = 1.0f;
+		}
+		break;
+	}
+	}
+}
+
+}
+
+void rowAVX512(const NoiseParam & param, const uint32_t y, const uint32_t x0, const uint32_t x1)
+{
+	uint32_t x = x0;
+	//colorful is only a few divisions per pixel, leave it to scalar
+	if (param.mode != cpuNoise::Mode::Colorful)
+	{
+		const size_t base = (size_t)y * param.width;
+		const __m512 iota = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		for (; x + 16 <= x1; x += 16)
+		{
+			const __m512 fx = _mm512_add_ps(_mm512_set1_ps((float)x), iota);
+			const __m512 val = param.mode == cpuNoise::Mode::Step ? stepNoise(param.level, fx, (float)y) : multiNoise(param.level, param.interp, fx, (float)y);
+			store(param, base + x, val);
+		}
+	}
+	if (x < x1)
+		rowScalar(param, y, x, x1);
+}
+
+}
+}
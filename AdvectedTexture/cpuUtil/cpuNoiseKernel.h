@@ -0,0 +1,31 @@
+#pragma once
+
+#include "cpuUtil.h"
+
+//shared by kernels of each instruction set, only declarations and constants here,
+//so no inline code compiled with AVX gets merged into code running on older CPUs
+namespace cpuu
+{
+namespace detail
+{
+
+struct NoiseParam
+{
+	cpuNoise::Mode mode;
+	int level, interp;
+	cpuNoise::Format fmt;
+	void * dst;
+	uint32_t width, height;
+};
+
+//cos(pi*t) on [0,0.5] by Taylor series in t^2, other half by symmetry. error below 2.1e-7
+static const float COSPI_C2 = -4.934802055e+00f, COSPI_C4 = 4.058712006e+00f, COSPI_C6 = -1.335262775e+00f,
+	COSPI_C8 = 2.353306264e-01f, COSPI_C10 = -2.580689080e-02f, COSPI_C12 = 1.929574297e-03f;
+
+//pixels [x0, x1) of row y, SIMD ones leave the tail to rowScalar
+void rowScalar(const NoiseParam & param, const uint32_t y, const uint32_t x0, const uint32_t x1);
+void rowAVX2(const NoiseParam & param, const uint32_t y, const uint32_t x0, const uint32_t x1);
+void rowAVX512(const NoiseParam & param, const uint32_t y, const uint32_t x0, const uint32_t x1);
+
+}
+}
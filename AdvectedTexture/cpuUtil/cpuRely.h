@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <intrin.h>
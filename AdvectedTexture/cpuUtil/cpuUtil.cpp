@@ -0,0 +1,372 @@
+#include "cpuNoiseKernel.h"
+#include <cmath>
+#include <algorithm>
+
+namespace cpuu
+{
+using std::min;
+using std::max;
+
+
+cpuThreadPool::cpuThreadPool(const uint32_t count)
+{
+	const uint32_t n = count ? count : max(std::thread::hardware_concurrency(), 1u);
+	for (uint32_t a = 0; a < n; ++a)
+		workers.emplace_back(new Worker());
+	for (uint32_t a = 0; a < n; ++a)
+		threads.emplace_back(&cpuThreadPool::workerLoop, this, a);
+}
+
+cpuThreadPool::~cpuThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		isQuit = true;
+	}
+	taskCV.notify_all();
+	for (auto & t : threads)
+		t.join();
+}
+
+bool cpuThreadPool::popTask(const size_t idx, function<void()> & task)
+{
+	//own tasks from back, which are pushed latest
+	{
+		auto & w = *workers[idx];
+		std::lock_guard<std::mutex> lock(w.mtx);
+		if (!w.tasks.empty())
+		{
+			task = std::move(w.tasks.back());
+			w.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+	//steal from front of others
+	for (size_t a = 1; a < workers.size(); ++a)
+	{
+		auto & w = *workers[(idx + a) % workers.size()];
+		std::lock_guard<std::mutex> lock(w.mtx);
+		if (!w.tasks.empty())
+		{
+			task = std::move(w.tasks.front());
+			w.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void cpuThreadPool::workerLoop(const size_t idx)
+{
+	function<void()> task;
+	while (true)
+	{
+		if (popTask(idx, task))
+		{
+			task();
+			if (--pending == 0)
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				doneCV.notify_all();
+			}
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(mtx);
+		taskCV.wait(lock, [&] { return isQuit || queued > 0; });
+		if (isQuit)
+			return;
+	}
+}
+
+void cpuThreadPool::parallelFor(const size_t count, const function<void(size_t)> & func)
+{
+	if (count == 0)
+		return;
+	//tasks must not call parallelFor, all workers may be waiting then
+	pending += count;
+	for (size_t a = 0; a < count; ++a)
+	{
+		auto & w = *workers[a % workers.size()];
+		std::lock_guard<std::mutex> lock(w.mtx);
+		queued++;
+		w.tasks.emplace_back([&func, a] { func(a); });
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+	}
+	taskCV.notify_all();
+	std::unique_lock<std::mutex> lock(mtx);
+	doneCV.wait(lock, [&] { return pending == 0; });
+}
+
+
+
+namespace detail
+{
+namespace
+{
+
+//mad24 of test.cl, only low 24 bits of operands are used
+inline uint32_t mad24u(const uint32_t a, const uint32_t b, const uint32_t c)
+{
+	return (a & 0xffffffu) * (b & 0xffffffu) + c;
+}
+inline uint32_t mad24i(const int32_t a, const int32_t b, const int32_t c)
+{
+	const uint32_t sa = (uint32_t)((int32_t)((uint32_t)a << 8) >> 8), sb = (uint32_t)((int32_t)((uint32_t)b << 8) >> 8);
+	return sa * sb + (uint32_t)c;
+}
+
+inline float getNoise(const int32_t x, const int32_t y)
+{
+	const uint32_t n = mad24i(y, 58, x) + mad24i(x, 4093, y);
+	return (float)mad24u(n, mad24u(n, n * 15731u, 789221u), 1376312589u) * (1.0f / 4294967296.0f);
+}
+
+inline float cosPi(const float t)
+{
+	const bool isHi = t > 0.5f;
+	const float tp = isHi ? 1.0f - t : t;
+	const float z = tp * tp;
+	float c = COSPI_C12;
+	c = c * z + COSPI_C10;
+	c = c * z + COSPI_C8;
+	c = c * z + COSPI_C6;
+	c = c * z + COSPI_C4;
+	c = c * z + COSPI_C2;
+	c = c * z + 1.0f;
+	return isHi ? -c : c;
+}
+
+inline float interW(const float t, const int interp)
+{
+	if (interp == 1)
+		return t;
+	if (interp == 2)
+		return t * t * (3.0f - 2.0f * t);
+	return 0.5f - cosPi(t) * 0.5f;
+}
+
+inline float mix(const float a, const float b, const float w)
+{
+	return a + (b - a) * w;
+}
+
+float stepNoise(const int level, const uint32_t x, const uint32_t y)
+{
+	float stp = 1.0f;
+	for (int a = 0; a < level; ++a)
+		stp *= 0.5f;
+	const float rx = (float)x * stp, ry = (float)y * stp;
+	const float fx0 = std::floor(rx), fy0 = std::floor(ry);
+	const int32_t x0 = (int32_t)fx0, y0 = (int32_t)fy0,
+		x1 = (int32_t)std::ceil(rx), y1 = (int32_t)std::ceil(ry);
+	const float w00 = getNoise(x0, y0),
+		w10 = getNoise(x1, y0),
+		w01 = getNoise(x0, y1),
+		w11 = getNoise(x1, y1);
+	const float wx = cosPi(rx - fx0) * -0.5f + 0.5f,
+		wy = cosPi(ry - fy0) * -0.5f + 0.5f;
+	return mix(mix(w00, w10, wx), mix(w01, w11, wx), wy);
+}
+
+float multiNoise(const int level, const int interp, const uint32_t x, const uint32_t y)
+{
+	float val = 0.0f, stp = 1.0f, amp = 1.0f;
+	for (int a = 0; a < level; ++a)
+		amp *= 0.5f;
+	for (int a = level; a-- > 0; amp *= 2, stp *= 0.5f)
+	{
+		const float rx = (float)x * stp, ry = (float)y * stp;
+		const float fx0 = std::floor(rx), fy0 = std::floor(ry);
+		const int32_t x0 = (int32_t)fx0, y0 = (int32_t)fy0,
+			x1 = (int32_t)std::ceil(rx), y1 = (int32_t)std::ceil(ry);
+		const float w00 = getNoise(x0, y0),
+			w10 = getNoise(x1, y0),
+			w01 = getNoise(x0, y1),
+			w11 = getNoise(x1, y1);
+		const float wx = interW(rx - fx0, interp), wy = interW(ry - fy0, interp);
+		val += mix(mix(w00, w10, wx), mix(w01, w11, wx), wy) * amp;
+	}
+	return val;
+}
+
+inline void storeVal(const NoiseParam & param, const size_t id, const float val)
+{
+	switch (param.fmt)
+	{
+	case cpuNoise::Format::R32F:
+		((float *)param.dst)[id] = val;
+		break;
+	case cpuNoise::Format::R16F:
+		((uint16_t *)param.dst)[id] = cpuNoise::floatToHalf(val);
+		break;
+	case cpuNoise::Format::R8:
+		((uint8_t *)param.dst)[id] = (uint8_t)std::nearbyint(min(max(val * 255.0f, 0.0f), 255.0f));
+		break;
+	default:
+	{
+		float * dst = (float *)param.dst + id * 4;
+		dst[0] = dst[1] = dst[2] = val;
+		dst[3] = 1.0f;
+		break;
+	}
+	}
+}
+
+}
+
+void rowScalar(const NoiseParam & param, const uint32_t y, const uint32_t x0, const uint32_t x1)
+{
+	const size_t base = (size_t)y * param.width;
+	for (uint32_t x = x0; x < x1; ++x)
+	{
+		switch (param.mode)
+		{
+		case cpuNoise::Mode::Colorful:
+		{
+			float * dst = (float *)param.dst + (base + x) * 4;
+			dst[0] = x * 1.0f / param.width;
+			dst[1] = y * 1.0f / param.height;
+			dst[2] = (x + y) * 1.0f / (param.width + param.height);
+			dst[3] = 1.0f;
+			break;
+		}
+		case cpuNoise::Mode::Step:
+			storeVal(param, base + x, stepNoise(param.level, x, y));
+			break;
+		default:
+			storeVal(param, base + x, multiNoise(param.level, param.interp, x, y));
+			break;
+		}
+	}
+}
+
+}
+
+
+
+cpuNoise::cpuNoise(const uint32_t threads, const ISA maxISA) : pool(threads)
+{
+	isa = (ISA)min((uint8_t)detectISA(), (uint8_t)maxISA);
+}
+
+cpuNoise::ISA cpuNoise::detectISA()
+{
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+	__cpuid(info, 1);
+	const bool hasOSXSAVE = (info[2] >> 27) & 1, hasAVX = (info[2] >> 28) & 1, hasF16C = (info[2] >> 29) & 1;
+	if (!hasOSXSAVE || !hasAVX || maxLeaf < 7)
+		return ISA::Scalar;
+	//OS has to save YMM(and opmask/ZMM) state
+	const uint64_t xcr0 = _xgetbv(0);
+	if ((xcr0 & 0x6) != 0x6)
+		return ISA::Scalar;
+	__cpuidex(info, 7, 0);
+	const bool hasAVX2 = (info[1] >> 5) & 1, hasAVX512F = (info[1] >> 16) & 1;
+	//AVX-512 unit is built with /arch:AVX512, which may also emit DQ, BW and VL instructions
+	const bool hasAVX512DQ = (info[1] >> 17) & 1, hasAVX512BW = (info[1] >> 30) & 1, hasAVX512VL = (info[1] >> 31) & 1;
+	if (hasAVX512F && hasAVX512DQ && hasAVX512BW && hasAVX512VL && (xcr0 & 0xe6) == 0xe6)
+		return ISA::AVX512;
+	if (hasAVX2 && hasF16C)
+		return ISA::AVX2;
+	return ISA::Scalar;
+}
+
+const char * cpuNoise::getISAName(const ISA isa)
+{
+	switch (isa)
+	{
+	case ISA::AVX2:
+		return "AVX2";
+	case ISA::AVX512:
+		return "AVX-512";
+	default:
+		return "scalar";
+	}
+}
+
+size_t cpuNoise::getPixelSize(const Format fmt)
+{
+	switch (fmt)
+	{
+	case Format::R32F:
+		return 4;
+	case Format::R16F:
+		return 2;
+	case Format::R8:
+		return 1;
+	default:
+		return 16;
+	}
+}
+
+uint16_t cpuNoise::floatToHalf(const float val)
+{
+	//round to nearest even, same as vstore_half and F16C
+	uint32_t f;
+	memcpy(&f, &val, sizeof(f));
+	const uint16_t sign = (uint16_t)((f >> 16) & 0x8000);
+	const uint32_t absf = f & 0x7fffffff;
+	if (absf >= 0x7f800000)
+		return sign | (absf > 0x7f800000 ? 0x7e00 : 0x7c00);
+	//65520 and above rounds to infinity
+	if (absf >= 0x477ff000)
+		return sign | 0x7c00;
+	if (absf < 0x38800000)
+	{
+		//subnormal half, 2^-25 and below rounds to zero
+		if (absf <= 0x33000000)
+			return sign;
+		const uint32_t mant = (absf & 0x7fffff) | 0x800000, shift = 126 - (absf >> 23);
+		uint32_t h = mant >> shift;
+		const uint32_t rem = mant & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+		if (rem > halfway || (rem == halfway && (h & 1)))
+			h++;
+		return sign | (uint16_t)h;
+	}
+	uint32_t h = (absf - 0x38000000) >> 13;
+	const uint32_t rem = absf & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++;
+	return sign | (uint16_t)h;
+}
+
+float cpuNoise::halfToFloat(const uint16_t h)
+{
+	const uint32_t sign = (uint32_t)(h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+	uint32_t f;
+	if (exp == 0x1f)
+		f = sign | 0x7f800000 | (mant << 13);
+	else if (exp == 0)
+	{
+		const float val = mant * (1.0f / 16777216.0f);
+		return sign ? -val : val;
+	}
+	else
+		f = sign | ((exp + 112) << 23) | (mant << 13);
+	float val;
+	memcpy(&val, &f, sizeof(val));
+	return val;
+}
+
+void cpuNoise::generate(const Mode mode, const int level, const int interp, const Format fmt, void * dst, const uint32_t width, const uint32_t height)
+{
+	const detail::NoiseParam param{ mode, level, interp, mode == Mode::Colorful ? Format::RGBA32F : fmt, dst, width, height };
+	const auto rowFunc = isa == ISA::AVX512 ? detail::rowAVX512 : (isa == ISA::AVX2 ? detail::rowAVX2 : detail::rowScalar);
+	const uint32_t tilesX = (width + TileW - 1) / TileW, tilesY = (height + TileH - 1) / TileH;
+	pool.parallelFor((size_t)tilesX * tilesY, [&](const size_t idx)
+	{
+		const uint32_t x0 = (uint32_t)(idx % tilesX) * TileW, y0 = (uint32_t)(idx / tilesX) * TileH;
+		const uint32_t x1 = min(x0 + TileW, width), y1 = min(y0 + TileH, height);
+		for (uint32_t y = y0; y < y1; ++y)
+			rowFunc(param, y, x0, x1);
+	});
+}
+
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "cpuRely.h"
+
+namespace cpuu
+{
+using std::vector;
+using std::function;
+using std::unique_ptr;
+
+
+/*fixed set of workers, each owning a task deque.
+workers pop own tasks from back and steal from front of others when empty*/
+class cpuThreadPool
+{
+private:
+	struct Worker
+	{
+		std::deque<function<void()>> tasks;
+		std::mutex mtx;
+	};
+	vector<unique_ptr<Worker>> workers;
+	vector<std::thread> threads;
+	std::atomic<size_t> queued{ 0 }, pending{ 0 };
+	std::mutex mtx;
+	std::condition_variable taskCV, doneCV;
+	bool isQuit = false;
+	bool popTask(const size_t idx, function<void()> & task);
+	void workerLoop(const size_t idx);
+public:
+	//0 means hardware concurrency
+	cpuThreadPool(const uint32_t count = 0);
+	cpuThreadPool(const cpuThreadPool &) = delete;
+	cpuThreadPool & operator = (const cpuThreadPool &) = delete;
+	~cpuThreadPool();
+	uint32_t getThreadCount() const { return (uint32_t)threads.size(); }
+	//run func(i) for i in [0, count), blocks until all finished
+	void parallelFor(const size_t count, const function<void(size_t)> & func);
+};
+
+
+/*value noise of test.cl computed on CPU, SIMD kernels over row spans, tiles spread over thread pool.
+instruction set is picked at runtime, AVX-512 and AVX2 results are identical to scalar ones.
+compared to CL output, floats differ within 2e-6(cospi and mad rounding), R16F within 1 ulp and R8 within 1 LSB.
+hash follows mad24 using low 24 bits of operands as GPUs do, CL runtimes doing full 32-bit multiply give other noise*/
+class cpuNoise
+{
+public:
+	enum class Mode : uint8_t { Colorful, Step, Multi };
+	//same values as FMT_* in test.cl
+	enum class Format : uint8_t { RGBA32F = 0, R32F = 1, R16F = 2, R8 = 3 };
+	enum class ISA : uint8_t { Scalar, AVX2, AVX512 };
+private:
+	static const uint32_t TileW = 256, TileH = 16;
+	cpuThreadPool pool;
+	ISA isa;
+public:
+	//ISA is the best supported one no higher than maxISA
+	cpuNoise(const uint32_t threads = 0, const ISA maxISA = ISA::AVX512);
+	ISA getISA() const { return isa; }
+	uint32_t getThreadCount() const { return pool.getThreadCount(); }
+	static ISA detectISA();
+	static const char * getISAName(const ISA);
+	static size_t getPixelSize(const Format);
+	static uint16_t floatToHalf(const float);
+	static float halfToFloat(const uint16_t);
+	/*write width*height pixels into dst, rows are tightly packed.
+	level is octave count of Multi and step exponent of Step, interp is INTERP of test.cl.
+	Colorful always outputs RGBA32F*/
+	void generate(const Mode mode, const int level, const int interp, const Format fmt, void * dst, const uint32_t width, const uint32_t height);
+};
+
+
+}
@@ -2,6 +2,7 @@
 #include "3dBasic/3dElement.h"
 #include "oclUtil/oclUtil.h"
 #include "oglUtil/oglUtil.h"
+#include "cpuUtil/cpuUtil.h"
 
 #include "rely.h"
 
@@ -16,10 +17,63 @@ static unique_ptr<oglProgram> glProg;
 static oclCommandQue clComQue;
 static oclPlatfrom clPlat;
 static oclProgram clProg;
-static oclKernel clkGenColorful, clkGenStepNoise, clkGenMultiNoise, clkGenNoiseBase, clkGenNoiseMulti;
+static oclKernel clkGenColorful, clkGenStepNoise, clkGenMultiNoise, clkGenNoiseBase, clkGenNoiseMulti, clkGenNoiseMultiTiled;
+static oclKernel clkGenStepNoiseRun, clkGenMultiNoiseRun;
+static oclKernel clkGenColorfulImg, clkGenStepNoiseImg, clkGenMultiNoiseImg, clkGenNoiseMultiImg;
+static oclKernel clkGenCurlField, clkResampleVel, clkAdvect, clkAdvectLayers, clkGenLayerNoise;
+static oclKernel clkClassifyTiles, clkAdvectTiles, clkStoreLayers;
+static size_t clTileSize[2];
+static cl_uint clRunWidth;
+static unique_ptr<oclKernelCache> clKerCache;
+static unique_ptr<oclWGTuner> clTuner;
+//octave counts used in production get specialized builds, others use runtime loop
+static const int clSpecLevels[] = { 4, 6, 8 };
+static int clLevel = 6, clInterp = 0;
 
-static oglBuffer glVBOVert, glVBOtex;
-static oclMem clMemTex, clMemPbo, clMemTmp;
+static oglBuffer glVBOVert;
+static oclMem clMemTex, clMemTmp;
+//write GL texture directly instead of going through PBO, for modes having image variants
+static bool clDirectTex = false;
+//sharing current texture failed, PBO path is used until size or format changes
+static bool clTexShareFailed = false;
+static oclMemPool clMemPool;
+/*advection state, ping-pong pair of float fields plus velocity in pixels per frame.
+each buffer holds advCurLayers fields back to back, clMemAdv[advIdx] holds latest frame.
+state is re-seeded with multi-octave noise when size or layer count changes or on request*/
+static oclMem clMemAdv[2], clMemVel;
+static int advIdx = 0, advCurLayers = 0;
+static size_t advSize[2]{ 0, 0 };
+static bool advReseed = true;
+static float advDt = 1.0f;
+/*curl-noise velocity, one vector per velDown*velDown pixels, re-generated every velInterval frames.
+stream function phase moves velSpeed per frame, velLevel octaves counted in cells*/
+static int velDown = 4, velInterval = 8, velLevel = 6;
+static float velSpeed = 0.01f, velStrength = 2.0f;
+static uint64_t velFrame = 0;
+//velocity streamed from an offline sim replaces curl noise when given, velSimTime is in sim frames
+static unique_ptr<oclVelStream> velStream;
+static double velSimTime = 0;
+static string velStreamFile;
+/*sparse advection: only AdvTile*AdvTile tiles where velocity moves pixels more than advTileThreshold per frame are processed.
+on by default with streamed velocity, where most of the field is usually still. toggled by 's'*/
+static const size_t AdvTile = 16;//ADV_TILE in test.cl
+static bool advSparse = false, advTileOK = false;
+static float advTileThreshold = 0.01f;
+static oclMem clMemTileFlag, clMemTileList, clMemTileCount;
+//tile flags describe last frame only when it was also sparse
+static bool advTilesValid = false;
+/*layered advection: each layer lives advPeriod frames then restarts from fresh noise,
+lifetimes are staggered so at most one layer is re-generated in a frame, and it has zero weight then*/
+static int advLayers = 3, advPeriod = 120;
+static uint64_t advFrame = 0;
+/*fresh noise of the layer restarting next(advFreshLayer) is built in clMemAdvFresh a band of rows per frame before its restart,
+so no frame generates a whole field. advFreshRows rows are done, advFreshEvt is the last band*/
+static oclMem clMemAdvFresh;
+static int advFreshLayer = -1;
+static size_t advFreshRows = 0;
+static oclEvent advFreshEvt;
+//last advection step, next one waits for it so out-of-order queues also keep frames in order
+static oclEvent advEvt;
 static shared_ptr<oglVAO> VAO;
 static oglTexture glTex;
 
@@ -30,6 +84,45 @@ static int sx, sy, mx, my;
 static Camera cam;
 static int clMode = 0;
 
+struct OutFormat
+{
+	const char * name;
+	_oglTexture::Format texFmt;
+	cl_int clFmt;//FMT_* in test.cl
+	size_t bpp;
+	const char * glslFmt;//image format in noise.comp
+};
+static const OutFormat outFormats[] =
+{
+	{ "RGBA32F", _oglTexture::Format::RGBAf, 0, 16, "rgba32f" },
+	{ "R32F", _oglTexture::Format::Rf, 1, 4, "r32f" },
+	{ "R16F", _oglTexture::Format::Rh, 2, 2, "r16f" },
+	{ "R8", _oglTexture::Format::R, 3, 1, "r8" },
+};
+static int outFmt = 1, curOutFmt = -1;
+//format of frame currently in glTex, shader's isMono follows it rather than the format being generated
+static int shownFmt = 0;
+
+//GL compute backend, one program per output format, compiled on first use
+static bool useGLCompute = false;
+static unique_ptr<oglProgram> glCompProgs[sizeof(outFormats) / sizeof(OutFormat)];
+static oglTexture glTexBase;
+
+/*ring of interop PBOs, CL writes newest frame into one slot while GL uploads an older one.
+a frame is consumed latency frames after it is generated, latency must be less than depth*/
+struct PboSlot
+{
+	oglBuffer pbo;
+	oclMem mem;
+	//unlock event of the frame not yet consumed
+	oclEvent done;
+	size_t w = 0, h = 0;
+	int fmt = 0;
+};
+static vector<PboSlot> pboRing;
+static int pboDepth = 3, pboLatency = 1;
+static uint64_t pboFrame = 0;
+
 void setTitle()
 {
 	char str[64];
@@ -85,7 +178,9 @@ void initGL()
 	}
 	glProg->use();
 
-	glVBOtex.reset(new _oglBuffer(_oglBuffer::Type::Pixel));
+	pboRing.resize(pboDepth);
+	for (auto & slot : pboRing)
+		slot.pbo.reset(new _oglBuffer(_oglBuffer::Type::Pixel));
 	glTex.reset(new _oglTexture(_oglTexture::Type::Tex2D));
 	float *empty = new float[dim * dim * 8];
 	//for (int a = 0; a < dim*dim * 8; a += 4)
@@ -95,24 +190,69 @@ void initGL()
 		_oglTexture::PropType::Filter, _oglTexture::PropVal::Nearest);
 	glTex->setData(_oglTexture::Format::RGBAf, dim, dim, empty);
 
-	glVBOtex->write(nullptr, 1920 * 1920 * 8 * 4, _oglBuffer::DrawMode::DynamicDraw);
-
 	genScreenBox();
 
 	delete[] empty;
 }
 
-void runCL(const int mode);
-void initCL()
+//drop frames still in the ring, so they won't overwrite the texture later
+void dropPboRing()
 {
-	string msg;
-	auto plats = oclUtil::getGLinterOPPlatforms();
-	for (auto & p : plats)
+	for (auto & slot : pboRing)
 	{
-		printf("\n%s\n%s\n", p->name.c_str(), p->ver.c_str());
+		if (slot.done)
+			slot.done->wait();
+		slot.done.reset();
 	}
-	clPlat = plats[0];
-	clComQue = oclUtil::getCommandQueue(clPlat);
+}
+
+//called when glTex gets a frame of fmt
+void setShownFormat(const int fmt)
+{
+	if (fmt == shownFmt)
+		return;
+	glUniform1i(glProg->getUniLoc("isMono"), fmt == 0 ? 0 : 1);
+	shownFmt = fmt;
+}
+
+//resize PBOs for the given output format, the shared CL buffers must be re-created after that
+void setOutFormat(const int fmt)
+{
+	if (fmt == curOutFmt)
+		return;
+	dropPboRing();
+	//PBOs are only used by CL backend
+	if (clPlat)
+	{
+		for (auto & slot : pboRing)
+		{
+			slot.mem.reset();
+			slot.pbo->write(nullptr, 1920 * 1920 * 2 * outFormats[fmt].bpp, _oglBuffer::DrawMode::DynamicDraw);
+			slot.mem = clPlat->createMem(slot.pbo);
+		}
+	}
+	curOutFmt = fmt;
+}
+
+//pick specialized variant for current level and interpolation, fallback to generic kernel
+oclKernel getNoiseKernel(const oclKernel & generic, const string & kname)
+{
+	string opts;
+	if (std::find(std::begin(clSpecLevels), std::end(clSpecLevels), clLevel) != std::end(clSpecLevels))
+		opts += "-D LEVEL=" + std::to_string(clLevel) + " ";
+	if (clInterp != 0)
+		opts += "-D INTERP=" + std::to_string(clInterp);
+	if (opts.empty())
+		return generic;
+	oclKernel ker = clKerCache->get(kname, opts);
+	return ker ? ker : generic;
+}
+
+//load program and kernels on clPlat, shared by window and headless mode
+void loadCLKernels(const size_t maxPixels)
+{
+	string msg;
+	oclUtil::setBinaryCacheDir("clcache");
 	clProg.reset(new _oclProgram(clPlat));
 
 	if (!clProg->load("test.cl", msg))
@@ -124,55 +264,610 @@ void initCL()
 	clkGenMultiNoise = oclUtil::getKernel(clProg, "genMultiNoise");
 	clkGenNoiseBase = oclUtil::getKernel(clProg, "genNoiseBase");
 	clkGenNoiseMulti = oclUtil::getKernel(clProg, "genNoiseMulti");
+	clkGenNoiseMultiTiled = oclUtil::getKernel(clProg, "genNoiseMultiTiled");
+	clkGenColorfulImg = oclUtil::getKernel(clProg, "genColorfulImg");
+	clkGenStepNoiseImg = oclUtil::getKernel(clProg, "genStepNoiseImg");
+	clkGenMultiNoiseImg = oclUtil::getKernel(clProg, "genMultiNoiseImg");
+	clkGenNoiseMultiImg = oclUtil::getKernel(clProg, "genNoiseMultiImg");
+	clkGenCurlField = oclUtil::getKernel(clProg, "genCurlField");
+	clkResampleVel = oclUtil::getKernel(clProg, "resampleVel");
+	clkAdvect = oclUtil::getKernel(clProg, "advect");
+	clkAdvectLayers = oclUtil::getKernel(clProg, "advectLayers");
+	clkGenLayerNoise = oclUtil::getKernel(clProg, "genLayerNoise");
+	clkClassifyTiles = oclUtil::getKernel(clProg, "classifyTiles");
+	clkAdvectTiles = oclUtil::getKernel(clProg, "advectTiles");
+	clkStoreLayers = oclUtil::getKernel(clProg, "storeLayers");
+	advTileOK = clkAdvectTiles->getWorkGroupSize() >= AdvTile * AdvTile;
+	if (!advTileOK)
+		printf("work-group of %zux%zu not supported, sparse advection disabled\n", AdvTile, AdvTile);
+	clKerCache.reset(new oclKernelCache(clProg));
+	clTuner.reset(new oclWGTuner("wgtune.txt"));
 	printf("Load CL kernel success!\n");
 
-	clMemPbo = clPlat->createMem(glVBOtex);
-	clMemTmp = clPlat->createMem(_oclMem::Type::ReadWrite, 1920 * 1920 * 8);
+	{
+		//pick a power-of-two tile no larger than 256 that the device accepts, width capped at 16
+		size_t wgSize = 1;
+		for (const size_t maxWG = min(clkGenNoiseMultiTiled->getWorkGroupSize(), (size_t)256); wgSize * 2 <= maxWG;)
+			wgSize *= 2;
+		clTileSize[0] = min(wgSize, (size_t)16);
+		clTileSize[1] = wgSize / clTileSize[0];
+		printf("tile size for genNoiseMultiTiled: %zux%zu\n", clTileSize[0], clTileSize[1]);
+	}
+	{
+		//run width follows device's native float vector width, only 4/8/16 variants exist
+		const cl_uint vecWidth = clPlat->getDefDevice()->floatVecWidth;
+		clRunWidth = vecWidth <= 4 ? 4 : (vecWidth <= 8 ? 8 : 16);
+		clkGenStepNoiseRun = oclUtil::getKernel(clProg, ("genStepNoise" + std::to_string(clRunWidth)).c_str());
+		clkGenMultiNoiseRun = oclUtil::getKernel(clProg, ("genMultiNoise" + std::to_string(clRunWidth)).c_str());
+		printf("run width for vectorized noise: %u\n", clRunWidth);
+	}
+
+	//scratch buffers come from pool, so re-sizing or re-creating them does not hit the driver every time
+	if (!clMemPool)
+		clMemPool = clPlat->createMemPool(256 * 1024 * 1024);
+	clMemTmp = clMemPool->alloc(_oclMem::Type::ReadWrite, maxPixels * 2 * sizeof(float));
+}
+
+//velocity stream is read on que, dropped when file can't be used
+void openVelStream(const oclCommandQue & que)
+{
+	if (velStreamFile.empty())
+		return;
+	velStream.reset(new oclVelStream(clPlat, que, velStreamFile));
+	if (!velStream->isOpen())
+		velStream.reset();
+	else
+		advSparse = true;
+}
+
+void runCL(const int mode);
+void initCL()
+{
+	auto plats = oclUtil::getGLinterOPPlatforms();
+	for (auto & p : plats)
+	{
+		printf("\n%s\n%s\n", p->name.c_str(), p->ver.c_str());
+	}
+	if (plats.empty())
+	{
+		printf("no CL-GL interop platform, use GL compute backend\n");
+		useGLCompute = true;
+		setOutFormat(outFmt);
+		return;
+	}
+	clPlat = plats[0];
+	clComQue = oclUtil::getCommandQueue(clPlat, true);
+	clComQue->getProfiler()->setDumpInterval(5000);
+	loadCLKernels(1920 * 1920);
+	openVelStream(clComQue);
+
+	setOutFormat(outFmt);
 
 	runCL(clMode);
 }
 
-void runCL(const int mode)
+/*advect only tiles with moving content, then write whole output from state.
+tiles active last frame but not now are copied once, so untouched tiles keep the same content in both ping-pong buffers*/
+oclEvent enqueueAdvectTiles(const oclCommandQue & que, const oclMem & dst, const cl_int clFmt, const size_t(&ws)[2], const int layers,
+	const cl_int regenMask, const float(&weights)[4], const bool isTune, const oclEventList & deps)
 {
-	t_begin = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-	const size_t ws[]{ cam.width, cam.height };
+	const size_t ts[]{ ws[0] / AdvTile, ws[1] / AdvTile };
+	const size_t tiles = ts[0] * ts[1];
+	//size only changes on seeding frames, which are dense
+	if (!advTilesValid)
+	{
+		clMemTileFlag = clMemPool->alloc(_oclMem::Type::ReadWrite, tiles);
+		clMemTileList = clMemPool->alloc(_oclMem::Type::ReadWrite, tiles * sizeof(cl_uint));
+		clMemTileCount = clMemPool->alloc(_oclMem::Type::ReadWrite, sizeof(cl_uint));
+	}
+	oclEventList prep{ clMemTileCount->fill(que, 0, deps) };
+	//last frame was dense, so both buffers differ everywhere: treat every tile as active last frame
+	if (!advTilesValid)
+		prep.push_back(clMemTileFlag->fill(que, 1, deps));
+	clkClassifyTiles->setArg(0, clMemVel);
+	clkClassifyTiles->setArg(1, (cl_int)velDown);
+	clkClassifyTiles->setArg(2, (cl_int)ws[0]);
+	clkClassifyTiles->setArg(3, (cl_int)ws[1]);
+	clkClassifyTiles->setArg(4, advTileThreshold / advDt);
+	clkClassifyTiles->setArg(5, clMemTileFlag);
+	clkClassifyTiles->setArg(6, clMemTileCount);
+	clkClassifyTiles->setArg(7, clMemTileList);
+	//not tuned: tuner runs kernel several times, which would bump count past list size and lose last frame's flags
+	auto classEvt = clkClassifyTiles->run<2>(que, ts, false, { 0 }, nullptr, prep);
 
-	if (!clMemPbo->lock(clComQue))
-		getchar();
+	//no indirect dispatch in CL 1.2, so one group per possible tile is launched and groups past the count exit at once
+	const size_t gs[]{ AdvTile, AdvTile * tiles }, ls[]{ AdvTile, AdvTile };
+	clkAdvectTiles->setArg(0, clMemAdv[advIdx]);
+	clkAdvectTiles->setArg(1, clMemVel);
+	clkAdvectTiles->setArg(2, (cl_int)velDown);
+	clkAdvectTiles->setArg(3, advDt);
+	clkAdvectTiles->setArg(4, (cl_int)ws[0]);
+	clkAdvectTiles->setArg(5, (cl_int)ws[1]);
+	clkAdvectTiles->setArg(6, (cl_int)layers);
+	clkAdvectTiles->setArg(7, regenMask);
+	//single field never restarts, any buffer fills the slot
+	clkAdvectTiles->setArg(8, layers > 1 ? clMemAdvFresh : clMemAdv[advIdx]);
+	clkAdvectTiles->setArg(9, clMemTileList);
+	clkAdvectTiles->setArg(10, clMemTileCount);
+	clkAdvectTiles->setArg(11, clMemAdv[advIdx ^ 1]);
+	auto advTileEvt = clkAdvectTiles->run<2>(que, gs, false, { 0 }, ls, { classEvt });
 
+	clkStoreLayers->setArg(0, clMemAdv[advIdx ^ 1]);
+	clkStoreLayers->setArg(1, (cl_int)layers);
+	clkStoreLayers->setArg(2, weights);
+	clkStoreLayers->setArg(3, dst);
+	clkStoreLayers->setArg(4, clFmt);
+	return clkStoreLayers->run<2>(que, ws, false, { 0 }, isTune ? clTuner->getLocalSize(que, clkStoreLayers, ws) : nullptr, { advTileEvt });
+}
+
+/*advance advection state by one step and write it to dst, seeding state and velocity first when needed.
+with more than one layer, layers are blended by weights following their lifetime phases.
+only runs over whole frame since backtrace reads arbitrary rows, sparse mode skips still tiles inside it*/
+oclEvent enqueueAdvect(const oclCommandQue & que, const oclMem & dst, const cl_int clFmt, const size_t(&ws)[2], const int layers,
+	const bool isTune, const oclEventList & waits)
+{
+	auto getLS = [&](const oclKernel & ker) -> const size_t *
+	{
+		return isTune ? clTuner->getLocalSize(que, ker, ws) : nullptr;
+	};
+	oclEventList deps = waits;
+	if (advEvt)
+		deps.push_back(advEvt);
+	const bool isSeed = advReseed || advSize[0] != ws[0] || advSize[1] != ws[1] || advCurLayers != layers;
+	if (isSeed)
+	{
+		const size_t fieldSize = ws[0] * ws[1] * sizeof(float);
+		for (auto & m : clMemAdv)
+			m = clMemPool->alloc(_oclMem::Type::ReadWrite, fieldSize * layers);
+		advIdx = 0;
+		if (layers == 1)
+		{
+			auto ker = getNoiseKernel(clkGenMultiNoise, "genMultiNoise");
+			ker->setArg(0, clLevel);
+			ker->setArg(1, clMemAdv[0]);
+			ker->setArg(2, (cl_int)1);//FMT_R32F
+			deps = { ker->run<2>(que, ws, false, { 0 }, getLS(ker), deps) };
+			clMemAdvFresh.reset();
+		}
+		else
+		{
+			//every layer starts at once only when seeding
+			auto ker = getNoiseKernel(clkGenLayerNoise, "genLayerNoise");
+			oclEventList seeds;
+			for (int l = 0; l < layers; ++l)
+			{
+				ker->setArg(0, clLevel);
+				ker->setArg(1, (cl_int)l);
+				ker->setArg(2, (cl_int)ws[1]);
+				ker->setArg(3, (cl_int)l);
+				ker->setArg(4, clMemAdv[0]);
+				seeds.push_back(ker->run<2>(que, ws, false, { 0 }, getLS(ker), deps));
+			}
+			deps = seeds;
+			clMemAdvFresh = clMemPool->alloc(_oclMem::Type::ReadWrite, fieldSize);
+		}
+		advFreshLayer = -1;
+		advFreshRows = 0;
+		advFreshEvt.reset();
+		advSize[0] = ws[0], advSize[1] = ws[1];
+		advCurLayers = layers;
+		advFrame = 0;
+		velFrame = 0;
+		advReseed = false;
+	}
+	const size_t vs[]{ (ws[0] + velDown - 1) / velDown, (ws[1] + velDown - 1) / velDown };
+	if (isSeed)
+		clMemVel = clMemPool->alloc(_oclMem::Type::ReadWrite, vs[0] * vs[1] * 2 * sizeof(float));
+	oclVelStream::View velView;
+	//streamed frames are interpolated every frame, stream keeps last frames when next ones are not staged in time
+	if (velStream && velStream->prepare(velSimTime, deps, velView))
+	{
+		const auto & hdr = velStream->getHeader();
+		const float scale[]{ (float)ws[0] / hdr.width * hdr.frameStep, (float)ws[1] / hdr.height * hdr.frameStep };
+		clkResampleVel->setArg(0, velView.a);
+		clkResampleVel->setArg(1, velView.b);
+		clkResampleVel->setArg(2, velView.t);
+		clkResampleVel->setArg(3, (cl_int)hdr.width);
+		clkResampleVel->setArg(4, (cl_int)hdr.height);
+		clkResampleVel->setArg(5, scale);
+		clkResampleVel->setArg(6, clMemVel);
+		auto velEvt = clkResampleVel->run<2>(que, vs, false, { 0 }, isTune ? clTuner->getLocalSize(que, clkResampleVel, vs) : nullptr, deps);
+		deps.push_back(velEvt);
+		velSimTime += hdr.frameStep;
+	}
+	//curl noise is small and changes slowly, so it is only refreshed every few frames
+	else if (isSeed || velFrame % velInterval == 0)
+	{
+		clkGenCurlField->setArg(0, velLevel);
+		clkGenCurlField->setArg(1, velFrame * velSpeed);
+		clkGenCurlField->setArg(2, velStrength);
+		clkGenCurlField->setArg(3, clMemVel);
+		//deps hold previous advection step, which still reads old field
+		auto velEvt = clkGenCurlField->run<2>(que, vs, false, { 0 }, isTune ? clTuner->getLocalSize(que, clkGenCurlField, vs) : nullptr, deps);
+		deps.push_back(velEvt);
+	}
+	velFrame++;
+	//phase of layer l is (frame + l * period / layers) % period, weight peaks at half of lifetime
+	float weights[4]{ 1, 0, 0, 0 };
+	cl_int regenMask = 0;
+	//layer to build fresh noise for after this step, and frames left before it restarts
+	int nextLayer = -1;
+	uint64_t nextLeft = 0;
+	//builds rows of fresh noise for layer, waiting for last step which may still read the buffer
+	auto buildFresh = [&](const int layer, const size_t rows, const oclEventList & waits)
+	{
+		if (advFreshLayer != layer)
+			advFreshLayer = layer, advFreshRows = 0;
+		const size_t cnt = min(rows, ws[1] - advFreshRows);
+		if (cnt == 0)
+			return;
+		oclEventList bandDeps = waits;
+		if (advFreshEvt)
+			bandDeps.push_back(advFreshEvt);
+		const size_t bs[]{ ws[0], cnt }, off[]{ 0, advFreshRows };
+		auto ker = getNoiseKernel(clkGenLayerNoise, "genLayerNoise");
+		ker->setArg(0, clLevel);
+		ker->setArg(1, (cl_int)layer);
+		ker->setArg(2, (cl_int)ws[1]);
+		ker->setArg(3, (cl_int)0);
+		ker->setArg(4, clMemAdvFresh);
+		//band height changes, so it is left to driver
+		advFreshEvt = ker->run<2>(que, bs, false, off, nullptr, bandDeps);
+		advFreshRows += cnt;
+	};
+	if (layers > 1)
+	{
+		float sqrSum = 0.0f;
+		for (int l = 0; l < layers; ++l)
+		{
+			const uint64_t age = (advFrame + (uint64_t)l * advPeriod / layers) % advPeriod;
+			//seeded state is already fresh
+			if (age == 0 && !isSeed)
+			{
+				//normally done by now, finished at once when it fell behind
+				buildFresh(l, ws[1], deps);
+				if (advFreshEvt)
+					deps.push_back(advFreshEvt);
+				regenMask |= 1 << l;
+			}
+			const uint64_t left = age == 0 ? advPeriod : advPeriod - age;
+			if (nextLayer < 0 || left < nextLeft)
+				nextLayer = l, nextLeft = left;
+			weights[l] = 1.0f - std::abs(2.0f * age / advPeriod - 1.0f);
+			sqrSum += weights[l] * weights[l];
+		}
+		for (auto & wt : weights)
+			wt /= std::sqrt(sqrSum);
+		advFrame++;
+	}
+	//seeding frame fills whole state, so it is always dense
+	const bool isSparse = advSparse && advTileOK && !isSeed && ws[0] % AdvTile == 0 && ws[1] % AdvTile == 0;
+	if (isSparse)
+		advEvt = enqueueAdvectTiles(que, dst, clFmt, ws, layers, regenMask, weights, isTune, deps);
+	else if (layers > 1)
+	{
+		clkAdvectLayers->setArg(0, clMemAdv[advIdx]);
+		clkAdvectLayers->setArg(1, clMemVel);
+		clkAdvectLayers->setArg(2, (cl_int)velDown);
+		clkAdvectLayers->setArg(3, advDt);
+		clkAdvectLayers->setArg(4, (cl_int)layers);
+		clkAdvectLayers->setArg(5, regenMask);
+		clkAdvectLayers->setArg(6, clMemAdvFresh);
+		clkAdvectLayers->setArg(7, weights);
+		clkAdvectLayers->setArg(8, clMemAdv[advIdx ^ 1]);
+		clkAdvectLayers->setArg(9, dst);
+		clkAdvectLayers->setArg(10, clFmt);
+		advEvt = clkAdvectLayers->run<2>(que, ws, false, { 0 }, getLS(clkAdvectLayers), deps);
+	}
+	else
+	{
+		clkAdvect->setArg(0, clMemAdv[advIdx]);
+		clkAdvect->setArg(1, clMemVel);
+		clkAdvect->setArg(2, (cl_int)velDown);
+		clkAdvect->setArg(3, advDt);
+		clkAdvect->setArg(4, clMemAdv[advIdx ^ 1]);
+		clkAdvect->setArg(5, dst);
+		clkAdvect->setArg(6, clFmt);
+		advEvt = clkAdvect->run<2>(que, ws, false, { 0 }, getLS(clkAdvect), deps);
+	}
+	//share of rows left for next layer, so it is complete at the frame it restarts
+	if (nextLayer >= 0)
+	{
+		const size_t done = advFreshLayer == nextLayer ? advFreshRows : 0;
+		buildFresh(nextLayer, (size_t)((ws[1] - done + nextLeft - 1) / nextLeft), { advEvt });
+	}
+	advIdx ^= 1;
+	advTilesValid = isSparse;
+	return advEvt;
+}
+
+/*enqueue kernels of given mode writing rows [rowOffset, rowOffset + ws[1]) of dst, returns event of the last command.
+local size comes from tuner only when isTune, otherwise left to driver.
+first kernel waits for waits, later ones wait for previous one, so it also works on out-of-order queue*/
+oclEvent enqueueGen(const oclCommandQue & que, const int mode, const oclMem & dst, const cl_int clFmt, const size_t(&ws)[2],
+	const size_t rowOffset = 0, const bool isTune = true, const oclEventList & waits = {})
+{
+	const size_t wsRun[]{ ws[0] / clRunWidth, ws[1] };
+	const size_t off[]{ 0, rowOffset };
+	auto getLS = [&](const oclKernel & ker, const size_t(&size)[2]) -> const size_t *
+	{
+		return isTune ? clTuner->getLocalSize(que, ker, size) : nullptr;
+	};
+	oclEvent evt;
 	switch(mode)
 	{
 	case 0:
-		clkGenColorful->setArg(0, clMemPbo);
-		clkGenColorful->run<2>(clComQue, ws);
+		clkGenColorful->setArg(0, dst);
+		evt = clkGenColorful->run<2>(que, ws, false, off, getLS(clkGenColorful, ws), waits);
 		break;
 	case 1:
 		clkGenStepNoise->setArg(0, 1);
-		clkGenStepNoise->setArg(1, clMemPbo);
-		clkGenStepNoise->run<2>(clComQue, ws);
+		clkGenStepNoise->setArg(1, dst);
+		clkGenStepNoise->setArg(2, clFmt);
+		evt = clkGenStepNoise->run<2>(que, ws, false, off, getLS(clkGenStepNoise, ws), waits);
 		break;
 	case 2:
+	{
 		clkGenNoiseBase->setArg(0, clMemTmp);
-		clkGenNoiseBase->run<2>(clComQue, ws);
-		clkGenNoiseMulti->setArg(0, 6);
-		clkGenNoiseMulti->setArg(1, clMemTmp);
-		clkGenNoiseMulti->setArg(2, clMemPbo);
-		clkGenNoiseMulti->run<2>(clComQue, ws);
+		auto baseEvt = clkGenNoiseBase->run<2>(que, ws, false, off, getLS(clkGenNoiseBase, ws), waits);
+		auto ker = getNoiseKernel(clkGenNoiseMulti, "genNoiseMulti");
+		ker->setArg(0, clLevel);
+		ker->setArg(1, clMemTmp);
+		ker->setArg(2, dst);
+		ker->setArg(3, clFmt);
+		evt = ker->run<2>(que, ws, false, off, getLS(ker, ws), { baseEvt });
 		break;
+	}
 	case 3:
-		clkGenMultiNoise->setArg(0, 6);
-		clkGenMultiNoise->setArg(1, clMemPbo);
-		clkGenMultiNoise->run<2>(clComQue, ws);
+	{
+		auto ker = getNoiseKernel(clkGenMultiNoise, "genMultiNoise");
+		ker->setArg(0, clLevel);
+		ker->setArg(1, dst);
+		ker->setArg(2, clFmt);
+		evt = ker->run<2>(que, ws, false, off, getLS(ker, ws), waits);
+		break;
+	}
+	case 4:
+	{
+		clkGenNoiseBase->setArg(0, clMemTmp);
+		auto baseEvt = clkGenNoiseBase->run<2>(que, ws, false, off, getLS(clkGenNoiseBase, ws), waits);
+		auto ker = getNoiseKernel(clkGenNoiseMultiTiled, "genNoiseMultiTiled");
+		ker->setArg(0, clLevel);
+		ker->setArg(1, clMemTmp);
+		ker->setLocalArg(2, (clTileSize[0] + 1) * (clTileSize[1] + 1) * sizeof(float));
+		ker->setArg(3, dst);
+		ker->setArg(4, clFmt);
+		evt = ker->run<2>(que, ws, false, off, clTileSize, { baseEvt });
+		break;
+	}
+	case 5:
+		clkGenStepNoiseRun->setArg(0, 1);
+		clkGenStepNoiseRun->setArg(1, dst);
+		clkGenStepNoiseRun->setArg(2, clFmt);
+		evt = clkGenStepNoiseRun->run<2>(que, wsRun, false, off, getLS(clkGenStepNoiseRun, wsRun), waits);
+		break;
+	case 6:
+	{
+		auto ker = getNoiseKernel(clkGenMultiNoiseRun, "genMultiNoise" + std::to_string(clRunWidth));
+		ker->setArg(0, clLevel);
+		ker->setArg(1, dst);
+		ker->setArg(2, clFmt);
+		evt = ker->run<2>(que, wsRun, false, off, getLS(ker, wsRun), waits);
+		break;
+	}
+	case 7:
+		evt = enqueueAdvect(que, dst, clFmt, ws, 1, isTune, waits);
+		break;
+	case 8:
+		evt = enqueueAdvect(que, dst, clFmt, ws, advLayers, isTune, waits);
 		break;
 	}
+	return evt;
+}
+
+//texture is replaced when re-allocated, release shared image before that, and give sharing another try
+void releaseSharedTex(const int fmt, const size_t(&ws)[2])
+{
+	if ((clMemTex || clTexShareFailed) && (glTex->getWidth() != (GLsizei)ws[0] || glTex->getHeight() != (GLsizei)ws[1] || glTex->getFormat() != outFormats[fmt].texFmt))
+		clMemTex.reset(), clTexShareFailed = false;
+}
 
-	if (!clMemPbo->unlock(clComQue))
+//image variants of modes 0-3 writing GL texture, returns null event for other modes
+oclEvent enqueueGenImg(const oclCommandQue & que, const int mode, const oclMem & dst, const size_t(&ws)[2], const oclEventList & waits = {})
+{
+	oclEvent evt;
+	switch (mode)
+	{
+	case 0:
+		clkGenColorfulImg->setArg(0, dst);
+		evt = clkGenColorfulImg->run<2>(que, ws, false, { 0 }, clTuner->getLocalSize(que, clkGenColorfulImg, ws), waits);
+		break;
+	case 1:
+		clkGenStepNoiseImg->setArg(0, 1);
+		clkGenStepNoiseImg->setArg(1, dst);
+		evt = clkGenStepNoiseImg->run<2>(que, ws, false, { 0 }, clTuner->getLocalSize(que, clkGenStepNoiseImg, ws), waits);
+		break;
+	case 2:
+	{
+		clkGenNoiseBase->setArg(0, clMemTmp);
+		auto baseEvt = clkGenNoiseBase->run<2>(que, ws, false, { 0 }, clTuner->getLocalSize(que, clkGenNoiseBase, ws), waits);
+		auto ker = getNoiseKernel(clkGenNoiseMultiImg, "genNoiseMultiImg");
+		ker->setArg(0, clLevel);
+		ker->setArg(1, clMemTmp);
+		ker->setArg(2, dst);
+		evt = ker->run<2>(que, ws, false, { 0 }, clTuner->getLocalSize(que, ker, ws), { baseEvt });
+		break;
+	}
+	case 3:
+	{
+		auto ker = getNoiseKernel(clkGenMultiNoiseImg, "genMultiNoiseImg");
+		ker->setArg(0, clLevel);
+		ker->setArg(1, dst);
+		evt = ker->run<2>(que, ws, false, { 0 }, clTuner->getLocalSize(que, ker, ws), waits);
+		break;
+	}
+	default:
+		break;
+	}
+	return evt;
+}
+
+//write texture through image interop, false when not possible so caller goes through PBO
+bool runCLDirect(const int mode, const int fmt, const size_t(&ws)[2])
+{
+	if (!clDirectTex || mode > 3 || clTexShareFailed)
+		return false;
+	glTex->allocate(outFormats[fmt].texFmt, (GLsizei)ws[0], (GLsizei)ws[1]);
+	if (!clMemTex)
+		clMemTex = clPlat->createMem(glTex);
+	if (!clMemTex)
+	{
+		clTexShareFailed = true;
+		return false;
+	}
+	dropPboRing();
+	if (!clMemTex->lock(clComQue))
+		return false;
+	enqueueGenImg(clComQue, mode, clMemTex, ws);
+	auto evt = clMemTex->unlock(clComQue);
+	//texture is sampled right after this
+	if (evt && !clComQue->canGLWaitRelease())
+		evt->wait();
+	else
+		clMemTex->glWaitUnlock();
+	setShownFormat(fmt);
+	return true;
+}
+
+void runCL(const int mode)
+{
+	t_begin = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	const size_t ws[]{ cam.width, cam.height };
+	//genColorful produces real colors, it can only output RGBA
+	const int fmt = mode == 0 ? 0 : outFmt;
+	setOutFormat(fmt);
+	const cl_int clFmt = outFormats[fmt].clFmt;
+
+	releaseSharedTex(fmt, ws);
+	if (runCLDirect(mode, fmt, ws))
+	{
+		t_end = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+		printf("mode %d(%s) level %d interp %d direct : running time:%lld\n", mode, outFormats[fmt].name, clLevel, clInterp, t_end - t_begin);
+		return;
+	}
+
+	//everything is on one in-order queue, only unlock event is kept and waited before GL consumes the PBO
+	auto & wslot = pboRing[pboFrame % pboDepth];
+	if (!wslot.mem->lock(clComQue))
 		getchar();
 
-	glTex->setData(_oglTexture::Format::RGBAf, ws[0], ws[1], glVBOtex);
+	enqueueGen(clComQue, mode, wslot.mem, clFmt, ws);
+
+	wslot.done = wslot.mem->unlock(clComQue);
+	if (!wslot.done)
+		getchar();
+	wslot.w = ws[0], wslot.h = ws[1], wslot.fmt = fmt;
+	clComQue->flush();
+
+	//consume frame generated latency frames ago, CL keeps working on newer ones meanwhile
+	if (pboFrame >= (uint64_t)pboLatency)
+	{
+		auto & rslot = pboRing[(pboFrame - pboLatency) % pboDepth];
+		if (rslot.done)
+		{
+			//only upload of this slot waits, GL work issued before does not wait for newer frames
+			if (!clComQue->canGLWaitRelease())
+				rslot.done->wait();
+			else
+				rslot.mem->glWaitUnlock();
+			rslot.done.reset();
+			glTex->setData(outFormats[rslot.fmt].texFmt, (GLsizei)rslot.w, (GLsizei)rslot.h, rslot.pbo);
+			setShownFormat(rslot.fmt);
+		}
+	}
+	pboFrame++;
 
 	t_end = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-	printf("mode %d : running time:%lld\n", mode, t_end - t_begin);
+	printf("mode %d(%s) level %d interp %d : running time:%lld\n", mode, outFormats[fmt].name, clLevel, clInterp, t_end - t_begin);
+}
+
+oglProgram * getCompProg(const int fmt)
+{
+	auto & prog = glCompProgs[fmt];
+	if (!prog)
+	{
+		prog.reset(new oglProgram());
+		string msg;
+		oglShader comp(oglShader::Type::Compute, "noise.comp", string("#define IMG_FMT ") + outFormats[fmt].glslFmt + "\n");
+		if (comp.compile(msg))
+			prog->addShader(move(comp));
+		else
+			printf("ERROR on Compute Shader Compiler:\n%s\n", msg.c_str());
+		if (!prog->link(msg))
+			printf("ERROR on Program Linker:\n%s\n", msg.c_str());
+	}
+	return prog.get();
+}
+
+/*generate with GL compute shader writing glTex by imageStore, no CL involved.
+tiled and run-of-N modes give same output as their plain versions*/
+void runGL(const int mode)
+{
+	t_begin = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	const size_t ws[]{ cam.width, cam.height };
+	const int fmt = mode == 0 ? 0 : outFmt;
+	setOutFormat(fmt);
+	dropPboRing();
+	releaseSharedTex(fmt, ws);
+	glTex->allocate(outFormats[fmt].texFmt, (GLsizei)ws[0], (GLsizei)ws[1]);
+
+	//stages in noise.comp of each mode
+	vector<int> stages;
+	switch (mode)
+	{
+	case 0:
+		stages = { 0 };
+		break;
+	case 1:
+	case 5:
+		stages = { 1 };
+		break;
+	case 2:
+	case 4:
+		if (!glTexBase)
+		{
+			glTexBase.reset(new _oglTexture(_oglTexture::Type::Tex2D));
+			glTexBase->setProperty(_oglTexture::PropType::Filter, _oglTexture::PropVal::Nearest);
+		}
+		glTexBase->allocate(_oglTexture::Format::Rf, (GLsizei)ws[0], (GLsizei)ws[1]);
+		glTexBase->bindImage(1, GL_READ_WRITE);
+		stages = { 2, 3 };
+		break;
+	//advection modes have no GL path, their multi-octave seed is shown instead
+	default:
+		stages = { 4 };
+		break;
+	}
+	auto prog = getCompProg(fmt);
+	prog->use();
+	glUniform1i(prog->getUniLoc("level"), mode == 1 || mode == 5 ? 1 : clLevel);
+	glUniform1i(prog->getUniLoc("interp"), clInterp);
+	glTex->bindImage(0, GL_WRITE_ONLY);
+	for (const int stage : stages)
+	{
+		glUniform1i(prog->getUniLoc("stage"), stage);
+		glDispatchCompute((GLuint)ws[0] / 16, (GLuint)ws[1] / 16, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	glProg->use();
+	setShownFormat(fmt);
+	//VAO expects glTex on texture unit 0
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, glTex->tID);
+
+	t_end = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	printf("mode %d(%s) level %d interp %d GL compute : running time:%lld\n", mode, outFormats[fmt].name, clLevel, clInterp, t_end - t_begin);
 }
 
 void display(void)
@@ -180,10 +875,17 @@ void display(void)
 	glClearColor(0, 0, 0, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	runCL(clMode);
+	if (useGLCompute)
+		runGL(clMode);
+	else
+		runCL(clMode);
 	VAO->draw(6);
 
 	glutSwapBuffers();
+	//frames in ring only show up after later frames are generated, so keep generating.
+	//advection animates by itself
+	if (pboLatency > 0 || (clMode >= 7 && !useGLCompute))
+		glutPostRedisplay();
 }
 
 void reshape(int w, int h)
@@ -217,9 +919,37 @@ void onKeyboard(unsigned char key, int x, int y)
 	switch (key)
 	{
 	case 13:
-		clMode = (clMode + 1) % 4;
+		clMode = (clMode + 1) % 9;
 		//runCL(clMode);
 		break;
+	case 'f':
+		outFmt = (outFmt + 1) % (sizeof(outFormats) / sizeof(OutFormat));
+		break;
+	case 'i':
+		clInterp = (clInterp + 1) % 3;
+		break;
+	case 't':
+		clDirectTex = !clDirectTex;
+		clTexShareFailed = false;
+		break;
+	case 'r':
+		advReseed = true;
+		break;
+	case 'l':
+		advLayers = advLayers == 2 ? 3 : 2;
+		break;
+	case 's':
+		advSparse = !advSparse;
+		break;
+	case 'b':
+		useGLCompute = !useGLCompute || !clPlat;
+		break;
+	case '+':
+		clLevel = min(clLevel + 1, 10);
+		break;
+	case '-':
+		clLevel = max(clLevel - 1, 1);
+		break;
 	default:
 		break;
 	}
@@ -264,8 +994,290 @@ void onWheel(int button, int dir, int x, int y)
 	glutPostRedisplay();
 }
 
+/*compute-only mode without window or GL interop, for throughput measurement on servers
+usage: --headless[-multi|-numa] width height frames mode [format] [outprefix] [velstream]
+frames are written as raw pixels to outprefix_NNNN.raw when outprefix is given, otherwise discarded("-" also discards).
+velstream is a velocity file for advection modes, read on upload queue of first device.
+-multi splits each frame into row bands over all devices of the platform,
+-numa additionally splits CPU devices into per-NUMA-node sub-devices*/
+int runHeadless(int argc, char** argv, const bool isMulti, const bool isNUMA)
+{
+	if (argc < 4)
+	{
+		printf("usage: --headless[-multi|-numa] width height frames mode [format(0-3)] [outprefix] [velstream]\n");
+		return -1;
+	}
+	//every kernel variant needs size to be multiple of 64, same as window mode
+	const size_t ws[]{ (size_t)atoi(argv[0]) & ~(size_t)63, (size_t)atoi(argv[1]) & ~(size_t)63 };
+	const int frames = atoi(argv[2]), mode = atoi(argv[3]);
+	const int fmt = mode == 0 ? 0 : (argc > 4 ? atoi(argv[4]) : outFmt);
+	const char * outPrefix = argc > 5 && strcmp(argv[5], "-") != 0 ? argv[5] : nullptr;
+	if (argc > 6)
+		velStreamFile = argv[6];
+	if (ws[0] == 0 || ws[1] == 0 || mode < 0 || mode > 8 || fmt < 0 || fmt > 3)
+	{
+		printf("invalid arguments\n");
+		return -1;
+	}
+
+	auto plats = oclUtil::getPlatforms();
+	if (plats.empty())
+	{
+		printf("no OpenCL platform found\n");
+		return -1;
+	}
+	clPlat = plats[0];
+	printf("\n%s\n%s\n", clPlat->name.c_str(), clPlat->ver.c_str());
+	if (isMulti)
+		clPlat->enableMultiDevice();
+	if (isNUMA)
+		clPlat->enableNUMASplit();
+	vector<oclQueueSet> queSets;
+	vector<oclCommandQue> ques;
+	//kernel limits, tile size and run width all come from default device, so whole-frame work runs there
+	const auto defDev = clPlat->getDefDevice();
+	size_t defIdx = 0;
+	for (const auto & dev : clPlat->getDevices())
+	{
+		if (dev == defDev)
+			defIdx = ques.size();
+		//every command is chained by events, so queues can be out-of-order where supported
+		queSets.emplace_back(clPlat, dev, true, true);
+		ques.push_back(queSets.back()[oclQueueSet::Role::Compute]);
+		printf("device: %s%s\n", dev->name.c_str(), ques.back()->isOutOfOrder() ? " (out-of-order)" : "");
+	}
+	clComQue = ques[defIdx];
+	loadCLKernels(ws[0] * ws[1]);
+	openVelStream(queSets[defIdx][oclQueueSet::Role::Upload]);
+
+	const size_t rowSize = ws[0] * outFormats[fmt].bpp, frameSize = rowSize * ws[1];
+	const cl_int clFmt = outFormats[fmt].clFmt;
+	//when every device shares memory with host, frames are written out from mapped buffers without extra copy
+	bool isZeroCopy = outPrefix != nullptr;
+	for (const auto & dev : clPlat->getDevices())
+		isZeroCopy = isZeroCopy && dev->isHostUnified;
+	const auto outType = isZeroCopy ? _oclMem::Type::HostAlloc : _oclMem::Type::WriteOnly;
+	//when writing out, two frames are in flight: frame N+1 is generated on compute queues while frame N is read back on download queues
+	struct Slot
+	{
+		//one full-frame buffer per device, each device only writes its own band
+		vector<oclMem> outs;
+		vector<uint8_t> data;
+		vector<oclRowScheduler::Band> bands;
+		oclEventList evts, reads, releases;
+		vector<oclMapView> views;
+		int idx = -1;
+	};
+	const int depth = outPrefix ? 2 : 1;
+	Slot slots[2];
+	for (int s = 0; s < depth; ++s)
+	{
+		for (size_t a = 0; a < ques.size(); ++a)
+		{
+			//buffer is first touched by its own device so pages of a sub-device land on its NUMA node
+			slots[s].outs.push_back(clMemPool->alloc(outType, frameSize));
+			if (auto evt = slots[s].outs.back()->fill(ques[a]))
+				evt->wait();
+		}
+		slots[s].data.resize(outPrefix && !isZeroCopy ? frameSize : 0);
+	}
+	oclRowScheduler sched(ques);
+	//bands are launched with global offset, kernels reading other rows(clMemTmp) or using full height can't be split
+	const bool canSplit = ques.size() > 1 && (mode == 1 || mode == 3 || mode == 5 || mode == 6);
+	printf("generating %d frames of %zux%zu, mode %d(%s) level %d, %s%s\n", frames, ws[0], ws[1], mode, outFormats[fmt].name, clLevel,
+		canSplit ? "split over devices" : "single device", isZeroCopy ? ", zero-copy output" : "");
+
+	//clMemTmp is shared by all frames, queue order no longer keeps next frame from overwriting it
+	const bool isTmpShared = mode == 2 || mode == 4;
+	oclEventList lastEvts;
+
+	auto genFrame = [&](Slot & slot, const int idx)
+	{
+		slot.idx = idx;
+		slot.bands = canSplit ? sched.split(ws[1], 64) : vector<oclRowScheduler::Band>{ { defIdx, 0, ws[1] } };
+		slot.evts.clear();
+		slot.reads.clear();
+		//buffers may still be mapped on download queues from last use of this slot
+		oclEventList waits = slot.releases;
+		if (isTmpShared)
+			waits.insert(waits.end(), lastEvts.begin(), lastEvts.end());
+		for (const auto & b : slot.bands)
+		{
+			const size_t bs[]{ ws[0], b.rows };
+			const auto & que = queSets[b.queIdx][oclQueueSet::Role::Compute];
+			slot.evts.push_back(enqueueGen(que, mode, slot.outs[b.queIdx], clFmt, bs, b.offset, !canSplit, waits));
+			que->flush();
+		}
+		slot.releases.clear();
+		lastEvts = slot.evts;
+		if (!outPrefix)
+			return;
+		for (size_t a = 0; a < slot.bands.size(); ++a)
+		{
+			const auto & b = slot.bands[a];
+			const auto & que = queSets[b.queIdx][oclQueueSet::Role::Download];
+			if (isZeroCopy)
+				slot.views.push_back(slot.outs[b.queIdx]->map(que, _oclMem::MapType::Read, b.offset * rowSize, b.rows * rowSize, false, { slot.evts[a] }));
+			else
+				slot.reads.push_back(slot.outs[b.queIdx]->read(que, b.offset * rowSize, &slot.data[b.offset * rowSize], b.rows * rowSize, false, { slot.evts[a] }));
+			que->flush();
+		}
+	};
+	auto finishFrame = [&](Slot & slot)
+	{
+		for (const auto & v : slot.views)
+			if (v.getEvent())
+				v.getEvent()->wait();
+		_oclEvent::wait(slot.reads);
+		_oclEvent::wait(slot.evts);
+		if (canSplit)
+			sched.update(slot.bands, slot.evts);
+		if (outPrefix && slot.idx >= 0)
+		{
+			char fname[512];
+			sprintf_s(fname, "%s_%04d.raw", outPrefix, slot.idx);
+			FILE *fp;
+			if (fopen_s(&fp, fname, "wb") == 0)
+			{
+				if (isZeroCopy)
+				{
+					for (size_t a = 0; a < slot.bands.size(); ++a)
+					{
+						fseek(fp, (long)(slot.bands[a].offset * rowSize), SEEK_SET);
+						fwrite(slot.views[a].data(), slot.views[a].getSize(), 1, fp);
+					}
+				}
+				else
+					fwrite(slot.data.data(), frameSize, 1, fp);
+				fclose(fp);
+			}
+		}
+		for (auto & v : slot.views)
+			slot.releases.push_back(v.unmap());
+		slot.views.clear();
+	};
+
+	//first frame also triggers building and tuning, keep it out of timing
+	genFrame(slots[0], -1);
+	finishFrame(slots[0]);
+	const auto t_start = std::chrono::steady_clock::now();
+	for (int a = 0; a < frames; ++a)
+	{
+		genFrame(slots[a % depth], a);
+		//previous frame is finished while this one is being generated
+		if (a + 1 >= depth)
+			finishFrame(slots[(a + 1 - depth) % depth]);
+	}
+	for (int a = max(frames + 1 - depth, 0); a < frames; ++a)
+		finishFrame(slots[a % depth]);
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+	printf("%d frames in %.3f s : %.2f fps, %.2f Mpixel/s\n", frames, secs, frames / secs, frames * ws[0] * ws[1] / secs / 1e6);
+	for (const auto & b : slots[frames > 0 ? (frames - 1) % depth : 0].bands)
+		printf("band of %s : rows %zu-%zu\n", clPlat->getDevices()[b.queIdx]->name.c_str(), b.offset, b.offset + b.rows);
+	for (const auto & qs : queSets)
+	{
+		qs[oclQueueSet::Role::Compute]->getProfiler()->dump();
+		if (outPrefix)
+			qs[oclQueueSet::Role::Download]->getProfiler()->dump();
+	}
+	const auto ps = clMemPool->getStat();
+	printf("mem pool: %llu hits, %llu misses, %zu bytes held, %zu bytes in use\n", ps.hits, ps.misses, ps.bytesHeld, ps.bytesInUse);
+	return 0;
+}
+
+/*same frames as --headless computed by SIMD CPU noise engine, no OpenCL needed
+usage: --headless-cpu width height frames mode [format] [outprefix]
+when an OpenCL platform exists, one frame is also generated there and max difference is printed*/
+int runHeadlessCPU(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		printf("usage: --headless-cpu width height frames mode [format(0-3)] [outprefix]\n");
+		return -1;
+	}
+	//same size rule as --headless so that frames are comparable
+	const size_t ws[]{ (size_t)atoi(argv[0]) & ~(size_t)63, (size_t)atoi(argv[1]) & ~(size_t)63 };
+	const int frames = atoi(argv[2]), mode = atoi(argv[3]);
+	const int fmt = mode == 0 ? 0 : (argc > 4 ? atoi(argv[4]) : outFmt);
+	const char * outPrefix = argc > 5 ? argv[5] : nullptr;
+	if (ws[0] == 0 || ws[1] == 0 || mode < 0 || mode > 6 || fmt < 0 || fmt > 3)
+	{
+		printf("invalid arguments\n");
+		return -1;
+	}
+	//CL modes only differ in how work is split, CPU has one kernel per noise type
+	using cpuu::cpuNoise;
+	const cpuNoise::Mode cpuMode = mode == 0 ? cpuNoise::Mode::Colorful : ((mode == 1 || mode == 5) ? cpuNoise::Mode::Step : cpuNoise::Mode::Multi);
+	const int level = cpuMode == cpuNoise::Mode::Step ? 1 : clLevel;
+	const auto cpuFmt = (cpuNoise::Format)outFormats[fmt].clFmt;
+
+	cpuNoise noise;
+	printf("CPU noise: %s, %u threads\n", cpuNoise::getISAName(noise.getISA()), noise.getThreadCount());
+	const size_t frameSize = ws[0] * ws[1] * outFormats[fmt].bpp;
+	vector<uint8_t> data(frameSize);
+	printf("generating %d frames of %zux%zu, mode %d(%s) level %d interp %d\n", frames, ws[0], ws[1], mode, outFormats[fmt].name, clLevel, clInterp);
+
+	const auto t_start = std::chrono::steady_clock::now();
+	for (int a = 0; a < frames; ++a)
+	{
+		noise.generate(cpuMode, level, clInterp, cpuFmt, data.data(), (uint32_t)ws[0], (uint32_t)ws[1]);
+		if (outPrefix)
+		{
+			char fname[512];
+			sprintf_s(fname, "%s_%04d.raw", outPrefix, a);
+			FILE *fp;
+			if (fopen_s(&fp, fname, "wb") == 0)
+			{
+				fwrite(data.data(), frameSize, 1, fp);
+				fclose(fp);
+			}
+		}
+	}
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+	printf("%d frames in %.3f s : %.2f fps, %.2f Mpixel/s\n", frames, secs, frames / secs, frames * ws[0] * ws[1] / secs / 1e6);
+
+	auto plats = oclUtil::getPlatforms();
+	if (plats.empty())
+		return 0;
+	clPlat = plats[0];
+	clComQue = oclUtil::getCommandQueue(clPlat);
+	loadCLKernels(ws[0] * ws[1]);
+	if (frames <= 0)
+		noise.generate(cpuMode, level, clInterp, cpuFmt, data.data(), (uint32_t)ws[0], (uint32_t)ws[1]);
+	vector<uint8_t> clData(frameSize);
+	auto clOut = clMemPool->alloc(_oclMem::Type::WriteOnly, frameSize);
+	auto evt = enqueueGen(clComQue, mode, clOut, outFormats[fmt].clFmt, ws, 0, false);
+	clOut->read(clComQue, clData.data(), frameSize, true, { evt });
+	auto decode = [&](const vector<uint8_t> & buf, const size_t id) -> float
+	{
+		switch (fmt)
+		{
+		case 2:
+			return cpuNoise::halfToFloat(((const uint16_t *)buf.data())[id]);
+		case 3:
+			return buf[id] / 255.0f;
+		default:
+			return ((const float *)buf.data())[id];
+		}
+	};
+	float maxDiff = 0.0f;
+	for (size_t a = 0, cnt = ws[0] * ws[1] * (fmt == 0 ? 4 : 1); a < cnt; ++a)
+		maxDiff = max(maxDiff, std::abs(decode(data, a) - decode(clData, a)));
+	printf("compared with %s : max difference %g\n", clPlat->getDefDevice()->name.c_str(), maxDiff);
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
+	if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+		return runHeadless(argc - 2, argv + 2, false, false);
+	if (argc > 1 && strcmp(argv[1], "--headless-multi") == 0)
+		return runHeadless(argc - 2, argv + 2, true, false);
+	if (argc > 1 && strcmp(argv[1], "--headless-numa") == 0)
+		return runHeadless(argc - 2, argv + 2, true, true);
+	if (argc > 1 && strcmp(argv[1], "--headless-cpu") == 0)
+		return runHeadlessCPU(argc - 2, argv + 2);
+
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
 	glutInitWindowSize(cam.width, cam.height);
@@ -281,6 +1293,15 @@ int main(int argc, char** argv)
 		scanf_s("%d", &dim);
 		getchar();
 	}
+	//optional PBO ring depth, frame latency and velocity stream for advection modes
+	if (argc > 2)
+		pboDepth = min(max(atoi(argv[2]), 1), 8);
+	if (argc > 3)
+		pboLatency = atoi(argv[3]);
+	if (argc > 4)
+		velStreamFile = argv[4];
+	pboLatency = min(max(pboLatency, 0), pboDepth - 1);
+	printf("PBO ring depth %d, latency %d\n", pboDepth, pboLatency);
 	initGL();
 	initCL();
 
@@ -2,8 +2,16 @@
 
 #include <memory>
 #include <vector>
+#include <map>
+#include <array>
 #include <string>
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cmath>
 #include <Windows.h>
 
 
@@ -5,6 +5,7 @@ namespace oclu
 {
 using std::min;
 using std::max;
+using std::make_pair;
 
 
 template<class T>
@@ -16,6 +17,7 @@ static shared_ptr<T> ErrorConstruct(const cl_int code)
 
 
 vector<oclPlatfrom> oclUtil::plfs;
+string oclUtil::binCacheDir;
 void oclUtil::init()
 {
 	static bool isFirst = true;
@@ -76,15 +78,34 @@ vector<oclPlatfrom> oclUtil::getGLinterOPPlatforms()
 	return glps;
 }
 
-oclCommandQue oclUtil::getCommandQueue(const oclPlatfrom plat)
+void oclUtil::setBinaryCacheDir(const string & dir)
 {
-	return getCommandQueue(plat, plat->defDev);
+	binCacheDir = dir;
+	if (!binCacheDir.empty())
+		CreateDirectoryA(binCacheDir.c_str(), NULL);
 }
 
-oclCommandQue oclUtil::getCommandQueue(const oclPlatfrom plat, const oclDevice dev)
+oclCommandQue oclUtil::getCommandQueue(const oclPlatfrom plat, const bool isProfiling, const bool isOutOfOrder)
+{
+	return getCommandQueue(plat, plat->defDev, isProfiling, isOutOfOrder);
+}
+
+oclCommandQue oclUtil::getCommandQueue(const oclPlatfrom plat, const oclDevice dev, const bool isProfiling, const bool isOutOfOrder)
 {
 	plat->init();
-	oclCommandQue cq(new _oclCommandQue(plat->context, dev->dID));
+	bool isOOO = false;
+	if (isOutOfOrder)
+	{
+		cl_command_queue_properties props = 0;
+		clGetDeviceInfo(dev->dID, CL_DEVICE_QUEUE_PROPERTIES, sizeof(props), &props, NULL);
+		isOOO = (props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+		if (!isOOO)
+			printf("%s does not support out-of-order queue, use in-order one\n", dev->name.c_str());
+	}
+	oclCommandQue cq(new _oclCommandQue(plat->context, dev->dID, isProfiling, isOOO));
+	cq->context = plat->context;
+	cq->clEventFromGLsync = plat->clEventFromGLsync;
+	cq->canGLWaitCL = plat->canGLWaitCL;
 	return cq;
 }
 
@@ -103,6 +124,132 @@ oclKernel oclUtil::getKernel(const oclProgram prog, const char * kname)
 
 
 
+_oclEvent::~_oclEvent()
+{
+	clReleaseEvent(evt);
+}
+
+void _oclEvent::wait() const
+{
+	clWaitForEvents(1, &evt);
+}
+
+bool _oclEvent::isFinished() const
+{
+	cl_int status;
+	clGetEventInfo(evt, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+	return status == CL_COMPLETE || status < 0;
+}
+
+double _oclEvent::getExecTime() const
+{
+	cl_ulong tStart, tEnd;
+	if (clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &tStart, NULL) != CL_SUCCESS
+		|| clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &tEnd, NULL) != CL_SUCCESS)
+		return -1.0;
+	return (tEnd - tStart) / 1e6;
+}
+
+void _oclEvent::wait(const oclEventList & evts)
+{
+	const auto evtWaits = toList(evts);
+	if (!evtWaits.empty())
+		clWaitForEvents((cl_uint)evtWaits.size(), evtWaits.data());
+}
+
+
+
+oclProfiler::oclProfiler(const uint32_t interval) : dumpInterval(interval), lastDump(std::chrono::steady_clock::now())
+{
+}
+
+void oclProfiler::record(const string & name, const oclEvent & evt)
+{
+	pendings.push_back(make_pair(name, evt));
+	collect();
+}
+
+void oclProfiler::collect()
+{
+	auto it = std::remove_if(pendings.begin(), pendings.end(), [&](const std::pair<string, oclEvent> & p)
+	{
+		if (!p.second->isFinished())
+			return false;
+		cl_ulong tQueued, tSubmit, tStart, tEnd;
+		if (clGetEventProfilingInfo(p.second->evt, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &tQueued, NULL) != CL_SUCCESS
+			|| clGetEventProfilingInfo(p.second->evt, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &tSubmit, NULL) != CL_SUCCESS
+			|| clGetEventProfilingInfo(p.second->evt, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &tStart, NULL) != CL_SUCCESS
+			|| clGetEventProfilingInfo(p.second->evt, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &tEnd, NULL) != CL_SUCCESS)
+			return true;//failed command or no profiling info, just drop it
+		const double exec = (tEnd - tStart) / 1e6, queue = (tSubmit - tQueued) / 1e6, submit = (tStart - tSubmit) / 1e6;
+		Record & rec = records[p.first];
+		rec.count++;
+		rec.sum += exec, rec.sumQueue += queue, rec.sumSubmit += submit;
+		rec.min = min(rec.min, exec), rec.max = max(rec.max, exec);
+		if (rec.samples.size() < maxSamples)
+			rec.samples.push_back(exec);
+		else
+			rec.samples[rec.samplePos] = exec;
+		rec.samplePos = (rec.samplePos + 1) % maxSamples;
+		return true;
+	});
+	pendings.erase(it, pendings.end());
+
+	if (dumpInterval > 0)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastDump).count() >= dumpInterval)
+		{
+			lastDump = now;
+			dump();
+		}
+	}
+}
+
+map<string, oclProfiler::Stat> oclProfiler::getStats()
+{
+	collect();
+	map<string, Stat> stats;
+	for (const auto & r : records)
+	{
+		const Record & rec = r.second;
+		if (rec.count == 0)
+			continue;
+		Stat st;
+		st.count = rec.count;
+		st.mean = rec.sum / rec.count;
+		st.meanQueue = rec.sumQueue / rec.count;
+		st.meanSubmit = rec.sumSubmit / rec.count;
+		st.min = rec.min, st.max = rec.max;
+		vector<double> sorted(rec.samples);
+		std::sort(sorted.begin(), sorted.end());
+		st.p50 = sorted[(sorted.size() - 1) * 50 / 100];
+		st.p99 = sorted[(sorted.size() - 1) * 99 / 100];
+		stats.insert(make_pair(r.first, st));
+	}
+	return stats;
+}
+
+void oclProfiler::dump()
+{
+	const auto stats = getStats();
+	printf("%-24s %8s %10s %10s %10s %10s %10s %10s %10s\n", "command", "count", "mean(ms)", "p50", "p99", "min", "max", "queue", "submit");
+	for (const auto & s : stats)
+	{
+		const Stat & st = s.second;
+		printf("%-24s %8llu %10.4f %10.4f %10.4f %10.4f %10.4f %10.4f %10.4f\n", s.first.c_str(), st.count,
+			st.mean, st.p50, st.p99, st.min, st.max, st.meanQueue, st.meanSubmit);
+	}
+}
+
+void oclProfiler::reset()
+{
+	pendings.clear();
+	records.clear();
+}
+
+
+
 _oclMem::_oclMem(const cl_context & context, const Type _type, const size_t _size) : type(_type), size(_size)
 {
 	isGL = false;
@@ -130,43 +277,214 @@ _oclMem::_oclMem(const cl_context & context, const Type _type, const oglTexture
 		throw ret;
 }
 
-bool _oclMem::lock(const oclCommandQue cmdQue)
+oclEvent _oclMem::lock(const oclCommandQue cmdQue, const oclEventList & waits)
 {
 	if (!isGL)
-		return false;
+		return oclEvent();
+	auto evtWaits = _oclEvent::toList(waits);
+	oclEvent glDone;
+	if (cmdQue->clEventFromGLsync)
+	{
+		if (glFence)
+			glDeleteSync(glFence);
+		glFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		cl_int ret;
+		cl_event glEvt = cmdQue->clEventFromGLsync(cmdQue->context, (cl_GLsync)glFence, &ret);
+		glDone = _oclEvent::create(ret, glEvt, false);
+		if (glDone)
+			evtWaits.push_back(glDone->evt);
+	}
+	//fence(or implicit sync) is only reached after being submitted
 	glFlush();
-	cl_int ret = clEnqueueAcquireGLObjects(cmdQue->cmdQue, 1, &memID, 0, NULL, NULL);
-	return ret == CL_SUCCESS;
+	cl_event evt;
+	cl_int ret = clEnqueueAcquireGLObjects(cmdQue->cmdQue, 1, &memID, (cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("AcquireGL", e);
+	return e;
 }
 
-bool _oclMem::unlock(const oclCommandQue cmdQue)
+oclEvent _oclMem::unlock(const oclCommandQue cmdQue, const oclEventList & waits)
 {
 	if (!isGL)
-		return false;
-	clFlush(cmdQue->cmdQue);
-	cl_int ret = clEnqueueReleaseGLObjects(cmdQue->cmdQue, 1, &memID, 0, NULL, NULL);
-	return ret == CL_SUCCESS;
+		return oclEvent();
+	if (!cmdQue->canGLWaitCL)
+		clFlush(cmdQue->cmdQue);
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret = clEnqueueReleaseGLObjects(cmdQue->cmdQue, 1, &memID, (cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("ReleaseGL", e);
+	if (e && cmdQue->canGLWaitCL)
+	{
+		//submit release, GL server waits for it only when the object is consumed
+		clFlush(cmdQue->cmdQue);
+		if (glRelease)
+			glDeleteSync(glRelease);
+		glRelease = glCreateSyncFromCLeventARB(cmdQue->context, e->evt, 0);
+	}
+	return e;
 }
 
-bool _oclMem::write(const oclCommandQue cmdQue, const void * buf, const size_t _size, const bool isBlock)
+void _oclMem::glWaitUnlock()
 {
-	cl_int ret = clEnqueueWriteBuffer(cmdQue->cmdQue, memID, isBlock ? CL_TRUE : CL_FALSE, 0, min(_size, size), buf, 0, NULL, NULL);
-	return ret == CL_SUCCESS;
+	if (!glRelease)
+		return;
+	glWaitSync(glRelease, 0, GL_TIMEOUT_IGNORED);
+	glDeleteSync(glRelease);
+	glRelease = nullptr;
 }
 
-bool _oclMem::read(const oclCommandQue cmdQue, void * buf, const size_t _size, const bool isBlock)
+oclEvent _oclMem::write(const oclCommandQue cmdQue, const void * buf, const size_t _size, const bool isBlock, const oclEventList & waits)
 {
-	cl_int ret = clEnqueueReadBuffer(cmdQue->cmdQue, memID, isBlock ? CL_TRUE : CL_FALSE, 0, min(_size, size), buf, 0, NULL, NULL);
-	return ret == CL_SUCCESS;
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret = clEnqueueWriteBuffer(cmdQue->cmdQue, memID, isBlock ? CL_TRUE : CL_FALSE, 0, min(_size, size), buf,
+		(cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("WriteBuffer", e);
+	return e;
+}
+
+oclEvent _oclMem::read(const oclCommandQue cmdQue, void * buf, const size_t _size, const bool isBlock, const oclEventList & waits)
+{
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret = clEnqueueReadBuffer(cmdQue->cmdQue, memID, isBlock ? CL_TRUE : CL_FALSE, 0, min(_size, size), buf,
+		(cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("ReadBuffer", e);
+	return e;
+}
+
+oclEvent _oclMem::read(const oclCommandQue cmdQue, const size_t offset, void * buf, const size_t _size, const bool isBlock, const oclEventList & waits)
+{
+	if (offset >= size)
+		return oclEvent();
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret = clEnqueueReadBuffer(cmdQue->cmdQue, memID, isBlock ? CL_TRUE : CL_FALSE, offset, min(_size, size - offset), buf,
+		(cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("ReadBuffer", e);
+	return e;
+}
+
+oclEvent _oclMem::fill(const oclCommandQue cmdQue, const uint8_t val, const oclEventList & waits)
+{
+	if (isGL)
+		return oclEvent();
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret = clEnqueueFillBuffer(cmdQue->cmdQue, memID, &val, 1, 0, size,
+		(cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("FillBuffer", e);
+	return e;
+}
+
+oclEvent _oclMem::copyTo(const oclCommandQue cmdQue, const oclMem & dst, const size_t _size, const oclEventList & waits)
+{
+	const size_t csize = min(_size == 0 ? size : _size, min(size, dst->size));
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret = clEnqueueCopyBuffer(cmdQue->cmdQue, memID, dst->memID, 0, 0, csize,
+		(cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("CopyBuffer", e);
+	return e;
+}
+
+oclMapView _oclMem::map(const oclCommandQue cmdQue, const MapType mtype, const size_t offset, const size_t _size, const bool isBlock, const oclEventList & waits)
+{
+	if (isGL || offset >= size)
+		return oclMapView();
+	const size_t msize = _size == 0 ? size - offset : min(_size, size - offset);
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret;
+	void * ptr = clEnqueueMapBuffer(cmdQue->cmdQue, memID, isBlock ? CL_TRUE : CL_FALSE, (cl_map_flags)mtype, offset, msize,
+		(cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt, &ret);
+	if (ret != CL_SUCCESS)
+	{
+		printf("\nERROR:%s\n", oclUtil::getErrorString(ret));
+		return oclMapView();
+	}
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("MapBuffer", e);
+	return oclMapView(cmdQue, memID, ptr, msize, e);
 }
 
 _oclMem::~_oclMem()
 {
+	if (glFence)
+		glDeleteSync(glFence);
+	if (glRelease)
+		glDeleteSync(glRelease);
 	clReleaseMemObject(memID);
 }
 
 
 
+oclMapView::oclMapView(const oclCommandQue & _cmdQue, const cl_mem _memID, void * _ptr, const size_t _size, const oclEvent & evt)
+	: cmdQue(_cmdQue), memID(_memID), ptr(_ptr), size(_size), mapEvt(evt)
+{
+	clRetainMemObject(memID);
+}
+
+oclMapView::oclMapView(oclMapView && other) : cmdQue(std::move(other.cmdQue)), memID(other.memID), ptr(other.ptr), size(other.size), mapEvt(std::move(other.mapEvt))
+{
+	other.memID = NULL;
+	other.ptr = nullptr;
+	other.size = 0;
+}
+
+oclMapView & oclMapView::operator = (oclMapView && other)
+{
+	if (this != &other)
+	{
+		unmap();
+		cmdQue = std::move(other.cmdQue);
+		memID = other.memID;
+		ptr = other.ptr;
+		size = other.size;
+		mapEvt = std::move(other.mapEvt);
+		other.memID = NULL;
+		other.ptr = nullptr;
+		other.size = 0;
+	}
+	return *this;
+}
+
+oclEvent oclMapView::unmap(const oclEventList & waits)
+{
+	if (!ptr)
+		return oclEvent();
+	auto evtWaits = _oclEvent::toList(waits);
+	if (mapEvt)
+		evtWaits.push_back(mapEvt->evt);
+	cl_event evt;
+	cl_int ret = clEnqueueUnmapMemObject(cmdQue->cmdQue, memID, ptr, (cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	oclEvent e = _oclEvent::create(ret, evt, false);
+	if (e && cmdQue->profiler)
+		cmdQue->profiler->record("UnmapBuffer", e);
+	clReleaseMemObject(memID);
+	memID = NULL;
+	ptr = nullptr;
+	size = 0;
+	mapEvt.reset();
+	return e;
+}
+
+
+
 _oclPlatfrom::_oclPlatfrom(const cl_platform_id _pID) :pID(_pID)
 {
 	{
@@ -201,13 +519,43 @@ void _oclPlatfrom::init()
 	//create OpenCL context
 	cl_context_properties props[] = { CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(pID), 0 };
 	//context = clCreateContextFromType(props, CL_DEVICE_TYPE_DEFAULT, NULL, NULL, &ret);
-	context = clCreateContext(props, 1, &defDevID, NULL, NULL, &ret);
-	isFirst = false;
+	ctxDevIDs.clear();
+	ctxDevs.clear();
 	for (auto & d : devs)
 	{
 		if (d->dID == defDevID)
 			defDev = d;
+		if (!isMultiDev && d->dID != defDevID)
+			continue;
+		vector<oclDevice> subs;
+		if (isNUMASplit && (d->type & CL_DEVICE_TYPE_CPU))
+			subs = d->partitionByAffinity(CL_DEVICE_AFFINITY_DOMAIN_NUMA);
+		if (subs.empty())
+			subs.push_back(d);
+		for (auto & sd : subs)
+			ctxDevIDs.push_back(sd->dID), ctxDevs.push_back(sd);
 	}
+	//default device may be replaced by its sub-devices
+	if (std::find(ctxDevIDs.begin(), ctxDevIDs.end(), defDevID) == ctxDevIDs.end())
+		defDevID = ctxDevIDs[0], defDev = ctxDevs[0];
+	context = clCreateContext(props, (cl_uint)ctxDevIDs.size(), ctxDevIDs.data(), NULL, NULL, &ret);
+	isFirst = false;
+}
+
+bool _oclPlatfrom::enableNUMASplit()
+{
+	if (!isFirst)
+		return false;
+	isNUMASplit = true;
+	return true;
+}
+
+bool _oclPlatfrom::enableMultiDevice()
+{
+	if (!isFirst)
+		return false;
+	isMultiDev = true;
+	return true;
 }
 
 void _oclPlatfrom::glInit(const cl_context_properties props[])
@@ -216,17 +564,32 @@ void _oclPlatfrom::glInit(const cl_context_properties props[])
 	//create OpenCL context
 	context = clCreateContext(props, 1, &defDevID, NULL, NULL, &ret);
 	isFirst = false;
+	{
+		//cl_khr_gl_event lets CL wait on GL fence, GL_ARB_cl_event lets GL wait on CL event
+		size_t len = 0;
+		clGetDeviceInfo(defDevID, CL_DEVICE_EXTENSIONS, 0, NULL, &len);
+		string exts(len, '\0');
+		clGetDeviceInfo(defDevID, CL_DEVICE_EXTENSIONS, len, &exts[0], NULL);
+		if (exts.find("cl_khr_gl_event") != string::npos)
+			clEventFromGLsync = (clCreateEventFromGLsyncKHR_fn)clGetExtensionFunctionAddressForPlatform(pID, "clCreateEventFromGLsyncKHR");
+		canGLWaitCL = GLEW_ARB_cl_event != 0;
+		printf("GL/CL sync: CL waits GL by %s, GL waits CL by %s\n", clEventFromGLsync ? "fence" : "glFlush",
+			canGLWaitCL ? "sync object" : "host");
+	}
+	ctxDevIDs.assign(1, defDevID);
+	ctxDevs.clear();
 	for (auto & d : devs)
 	{
 		if (d->dID == defDevID)
-			defDev = d;
+			defDev = d, ctxDevs.push_back(d);
 	}
 }
 
 _oclPlatfrom::~_oclPlatfrom()
 {
 	cl_int ret;
-	ret = clReleaseContext(context);
+	if (context)
+		ret = clReleaseContext(context);
 }
 
 oclMem _oclPlatfrom::createMem(const oglBuffer buf)
@@ -270,7 +633,128 @@ oclMem _oclPlatfrom::createMem(const _oclMem::Type _type, const size_t _size)
 
 
 
-_oclDevice::_oclDevice(const _oclPlatfrom & _plat, const cl_device_id _dID) :dID(_dID)
+oclMemPool _oclPlatfrom::createMemPool(const size_t highWater)
+{
+	return oclMemPool(new _oclMemPool(context, highWater));
+}
+
+
+
+size_t _oclMemPool::getSizeClass(const size_t size)
+{
+	const size_t minSize = 4096;
+	if (size <= minSize)
+		return minSize;
+	size_t hibit = minSize;
+	while (hibit <= size / 2)
+		hibit *= 2;
+	const size_t step = hibit / 4;
+	return (size + step - 1) / step * step;
+}
+
+_oclMemPool::~_oclMemPool()
+{
+	for (auto & f : frees)
+		for (auto m : f.second)
+			delete m;
+}
+
+oclMem _oclMemPool::alloc(const _oclMem::Type type, const size_t size)
+{
+	const size_t csize = getSizeClass(size);
+	_oclMem * mem = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = frees.find(make_pair((cl_mem_flags)type, csize));
+		if (it != frees.end() && !it->second.empty())
+		{
+			mem = it->second.back();
+			it->second.pop_back();
+			stat.hits++;
+			stat.bytesHeld -= csize;
+		}
+		else
+			stat.misses++;
+		stat.bytesInUse += csize;
+	}
+	if (!mem)
+	{
+		try
+		{
+			mem = new _oclMem(context, type, csize);
+		}
+		catch (const cl_int e)
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stat.bytesInUse -= csize;
+			return ErrorConstruct<_oclMem>(e);
+		}
+	}
+	std::weak_ptr<_oclMemPool> wpool = shared_from_this();
+	return oclMem(mem, [wpool](_oclMem * m)
+	{
+		if (auto pool = wpool.lock())
+			pool->recycle(m);
+		else
+			delete m;
+	});
+}
+
+void _oclMemPool::recycle(_oclMem * mem)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	frees[make_pair((cl_mem_flags)mem->type, mem->size)].push_back(mem);
+	stat.bytesInUse -= mem->size;
+	stat.bytesHeld += mem->size;
+	if (stat.bytesHeld > highWater)
+		trimTo(highWater);
+}
+
+void _oclMemPool::trimTo(const size_t target)
+{
+	//release from largest size class first, map is keyed by flags first so each round looks through all lists
+	while (stat.bytesHeld > target)
+	{
+		auto victim = frees.end();
+		for (auto it = frees.begin(); it != frees.end(); ++it)
+			if (!it->second.empty() && (victim == frees.end() || it->first.second > victim->first.second))
+				victim = it;
+		if (victim == frees.end())
+			break;
+		auto & list = victim->second;
+		stat.bytesHeld -= list.back()->size;
+		stat.trimmed++;
+		delete list.back();
+		list.pop_back();
+	}
+}
+
+void _oclMemPool::setHighWater(const size_t _highWater)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	highWater = _highWater;
+	trimTo(highWater);
+}
+
+void _oclMemPool::trim(const size_t target)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	trimTo(target);
+}
+
+_oclMemPool::Stat _oclMemPool::getStat()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return stat;
+}
+
+
+
+_oclDevice::_oclDevice(const _oclPlatfrom & _plat, const cl_device_id _dID) : _oclDevice(_dID, false)
+{
+}
+
+_oclDevice::_oclDevice(const cl_device_id _dID, const bool _isSub) :dID(_dID), isSub(_isSub)
 {
 	char str[128] = { 0 };
 	clGetDeviceInfo(dID, CL_DEVICE_NAME, 127, str, NULL);
@@ -279,14 +763,74 @@ _oclDevice::_oclDevice(const _oclPlatfrom & _plat, const cl_device_id _dID) :dID
 	vendor.assign(str);
 	clGetDeviceInfo(dID, CL_DEVICE_PROFILE, 127, str, NULL);
 	profile.assign(str);
+	clGetDeviceInfo(dID, CL_DRIVER_VERSION, 127, str, NULL);
+	driver.assign(str);
+	clGetDeviceInfo(dID, CL_DEVICE_TYPE, sizeof(cl_device_type), &type, NULL);
+	clGetDeviceInfo(dID, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, sizeof(cl_uint), &floatVecWidth, NULL);
+	cl_bool unified = CL_FALSE;
+	clGetDeviceInfo(dID, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL);
+	isHostUnified = unified == CL_TRUE;
+}
+
+_oclDevice::~_oclDevice()
+{
+	if (isSub)
+		clReleaseDevice(dID);
+}
+
+vector<oclDevice> _oclDevice::partitionByAffinity(const cl_device_affinity_domain domain)
+{
+	vector<oclDevice> subs;
+	const cl_device_partition_property props[] = { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, (cl_device_partition_property)domain, 0 };
+	cl_uint count = 0;
+	if (clCreateSubDevices(dID, props, 0, NULL, &count) != CL_SUCCESS || count < 2)
+		return subs;
+	vector<cl_device_id> subIDs(count);
+	if (clCreateSubDevices(dID, props, count, subIDs.data(), NULL) != CL_SUCCESS)
+		return subs;
+	for (cl_uint a = 0; a < count; ++a)
+	{
+		oclDevice sd(new _oclDevice(subIDs[a], true));
+		sd->name += " #" + std::to_string(a);
+		subs.push_back(sd);
+	}
+	return subs;
 }
 
 
 
-_oclCommandQue::_oclCommandQue(const cl_context & context, const cl_device_id dID)
+_oclCommandQue::_oclCommandQue(const cl_context & context, const cl_device_id dID, const bool isProfiling, const bool isOutOfOrder) : isOOO(isOutOfOrder)
 {
 	cl_int ret;
-	cmdQue = clCreateCommandQueue(context, dID, 0, &ret);
+	cl_command_queue_properties props = 0;
+	if (isProfiling)
+		props |= CL_QUEUE_PROFILING_ENABLE;
+	if (isOutOfOrder)
+		props |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+	cmdQue = clCreateCommandQueue(context, dID, props, &ret);
+	if (isProfiling)
+		profiler.reset(new oclProfiler());
+}
+
+void _oclCommandQue::flush()
+{
+	clFlush(cmdQue);
+}
+
+oclEvent _oclCommandQue::marker(const oclEventList & waits)
+{
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret = clEnqueueMarkerWithWaitList(cmdQue, (cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	return _oclEvent::create(ret, evt, false);
+}
+
+oclEvent _oclCommandQue::barrier(const oclEventList & waits)
+{
+	const auto evtWaits = _oclEvent::toList(waits);
+	cl_event evt;
+	cl_int ret = clEnqueueBarrierWithWaitList(cmdQue, (cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+	return _oclEvent::create(ret, evt, false);
 }
 
 _oclCommandQue::~_oclCommandQue()
@@ -308,14 +852,13 @@ _oclProgram::~_oclProgram()
 {
 	/* Finalization */
 	cl_int ret;
-	ret = clReleaseProgram(program);
+	if (program)
+		ret = clReleaseProgram(program);
 }
 
-bool _oclProgram::load(const char * fname, string & msg)
+bool _oclProgram::load(const char * fname, string & msg, const string & _options)
 {
 	FILE *fp;
-	cl_int ret;
-	char logstr[20480];
 
 	if (fopen_s(&fp, fname, "rb") != 0)
 	{
@@ -330,34 +873,147 @@ bool _oclProgram::load(const char * fname, string & msg)
 	char * _src = new char[fsize + 1];
 	fread(_src, fsize, 1, fp);
 	_src[fsize] = '\0';
-	src.assign(_src);
+	string fsrc(_src);
 	fclose(fp);
 	delete[] _src;
 
+	return build(fsrc, msg, _options);
+}
+
+bool _oclProgram::build(const string & _src, string & msg, const string & _options)
+{
+	cl_int ret;
+	char logstr[20480];
+
+	src = _src;
+	options = _options;
+	if (program)
+		clReleaseProgram(program);
+	program = NULL;
+
+	const auto t_begin = std::chrono::high_resolution_clock::now();
+	//binary cache only handles single device context
+	const bool useCache = !oclUtil::binCacheDir.empty() && plat->ctxDevIDs.size() == 1;
+	const uint64_t key = useCache ? getCacheKey() : 0;
+	string cachePath;
+	if (useCache)
+	{
+		sprintf_s(logstr, "%s/%016llx.bin", oclUtil::binCacheDir.c_str(), key);
+		cachePath.assign(logstr);
+		if (loadBinary(cachePath, key))
+		{
+			const auto t_end = std::chrono::high_resolution_clock::now();
+			printf("program binary cache hit [%s] in %.3f ms\n", cachePath.c_str(),
+				std::chrono::duration<double, std::milli>(t_end - t_begin).count());
+			return true;
+		}
+	}
+
 	const char *_src_tmp = src.c_str();
+	const size_t srcsize = src.size();
 	/* Create Kernel Program from the source */
-	program = clCreateProgramWithSource(plat->context, 1, &_src_tmp, &fsize, &ret);
+	program = clCreateProgramWithSource(plat->context, 1, &_src_tmp, &srcsize, &ret);
 	if (ret != CL_SUCCESS)
 	{
+		program = NULL;
 		sprintf_s(logstr, "Fail when create program, error code: %d", ret);
 		msg.assign(logstr);
 		return false;
 	}
 
 	/* Build Kernel Program */
-	ret = clBuildProgram(program, 1, &plat->defDevID, NULL, NULL, NULL);
+	ret = clBuildProgram(program, (cl_uint)plat->ctxDevIDs.size(), plat->ctxDevIDs.data(), options.c_str(), NULL, NULL);
 	if (ret != CL_SUCCESS)
 	{
 		clGetProgramBuildInfo(program, plat->defDevID, CL_PROGRAM_BUILD_LOG, sizeof(logstr), logstr, NULL);
 		msg.assign(logstr);
 		return false;
 	}
+	if (useCache)
+	{
+		saveBinary(cachePath, key);
+		const auto t_end = std::chrono::high_resolution_clock::now();
+		printf("program binary cache miss [%s], built from source in %.3f ms\n", cachePath.c_str(),
+			std::chrono::duration<double, std::milli>(t_end - t_begin).count());
+	}
 	return true;
 }
 
+uint64_t _oclProgram::getCacheKey() const
+{
+	//FNV-1a over everything that makes a binary invalid
+	const string * const parts[] = { &src, &options, &plat->ver, &plat->defDev->name, &plat->defDev->driver };
+	uint64_t hash = 14695981039346656037ull;
+	for (const string * str : parts)
+	{
+		for (const char ch : *str)
+			hash = (hash ^ (uint8_t)ch) * 1099511628211ull;
+		hash = (hash ^ 0xff) * 1099511628211ull;
+	}
+	return hash;
+}
+
+bool _oclProgram::loadBinary(const string & fpath, const uint64_t key)
+{
+	FILE *fp;
+	if (fopen_s(&fp, fpath.c_str(), "rb") != 0)
+		return false;
+
+	//header: cache key, binary size
+	uint64_t header[2] = { 0 };
+	vector<unsigned char> bin;
+	bool isValid = fread(header, sizeof(header), 1, fp) == 1 && header[0] == key && header[1] > 0;
+	if (isValid)
+	{
+		bin.resize((size_t)header[1]);
+		isValid = fread(bin.data(), bin.size(), 1, fp) == 1;
+	}
+	fclose(fp);
+	if (!isValid)
+		return false;
 
+	cl_int ret, binStatus;
+	const unsigned char *binPtr = bin.data();
+	const size_t binSize = bin.size();
+	program = clCreateProgramWithBinary(plat->context, 1, &plat->defDevID, &binSize, &binPtr, &binStatus, &ret);
+	if (ret != CL_SUCCESS)
+	{
+		program = NULL;
+		return false;
+	}
+	if (binStatus != CL_SUCCESS || clBuildProgram(program, 1, &plat->defDevID, options.c_str(), NULL, NULL) != CL_SUCCESS)
+	{
+		//stale binary, let caller build from source
+		clReleaseProgram(program);
+		program = NULL;
+		return false;
+	}
+	return true;
+}
 
-_oclKernel::_oclKernel(const oclProgram _prog, const char * kname) :clProg(_prog)
+void _oclProgram::saveBinary(const string & fpath, const uint64_t key)
+{
+	size_t binSize = 0;
+	clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binSize, NULL);
+	if (binSize == 0)
+		return;
+	vector<unsigned char> bin(binSize);
+	unsigned char *binPtr = bin.data();
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &binPtr, NULL) != CL_SUCCESS)
+		return;
+
+	FILE *fp;
+	if (fopen_s(&fp, fpath.c_str(), "wb") != 0)
+		return;
+	const uint64_t header[2] = { key, binSize };
+	fwrite(header, sizeof(header), 1, fp);
+	fwrite(bin.data(), binSize, 1, fp);
+	fclose(fp);
+}
+
+
+
+_oclKernel::_oclKernel(const oclProgram _prog, const char * kname) :clProg(_prog), name(kname)
 {
 	cl_int ret;
 	kernel = clCreateKernel(clProg->program, kname, &ret);
@@ -370,12 +1026,207 @@ _oclKernel::~_oclKernel()
 	clReleaseKernel(kernel);
 }
 
+oclDevice _oclKernel::getDevice() const
+{
+	return clProg->plat->defDev;
+}
+
+size_t _oclKernel::getWorkGroupSize() const
+{
+	size_t wgSize = 0;
+	clGetKernelWorkGroupInfo(kernel, clProg->plat->defDevID, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &wgSize, NULL);
+	return wgSize;
+}
+
+size_t _oclKernel::getPreferredWorkGroupMultiple() const
+{
+	size_t wgMul = 1;
+	clGetKernelWorkGroupInfo(kernel, clProg->plat->defDevID, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &wgMul, NULL);
+	return wgMul;
+}
+
 bool _oclKernel::setArg(const cl_uint idx, const oclMem mem)
 {
 	cl_int ret = clSetKernelArg(kernel, idx, sizeof(cl_mem), &(mem.get()->memID));
 	return ret == CL_SUCCESS;
 }
 
+bool _oclKernel::setLocalArg(const cl_uint idx, const size_t size)
+{
+	cl_int ret = clSetKernelArg(kernel, idx, size, NULL);
+	return ret == CL_SUCCESS;
+}
+
+
+
+oclKernel oclKernelCache::get(const string & kname, const string & options)
+{
+	const auto key = make_pair(kname, options);
+	auto itK = kernels.find(key);
+	if (itK != kernels.end())
+		return itK->second;
+
+	oclProgram prog = baseProg;
+	if (!options.empty())
+	{
+		auto itP = progs.find(options);
+		if (itP == progs.end())
+		{
+			prog.reset(new _oclProgram(baseProg->plat));
+			string msg;
+			if (!prog->build(baseProg->src, msg, options))
+			{
+				printf("\nERROR when building program with [%s]:\n%s\n", options.c_str(), msg.c_str());
+				prog.reset();
+			}
+			//failed build is also recorded, so it won't be retried
+			itP = progs.insert(make_pair(options, prog)).first;
+		}
+		prog = itP->second;
+	}
+	oclKernel ker = prog ? oclUtil::getKernel(prog, kname.c_str()) : oclKernel();
+	kernels.insert(make_pair(key, ker));
+	return ker;
+}
+
+
+
+oclWGTuner::oclWGTuner(const string & _fpath) : fpath(_fpath)
+{
+	FILE *fp;
+	if (fopen_s(&fp, fpath.c_str(), "r") != 0)
+		return;
+	//each line: key \t lx \t ly
+	char line[1024];
+	while (fgets(line, sizeof(line), fp))
+	{
+		string str(line);
+		const size_t p2 = str.rfind('\t');
+		if (p2 == string::npos || p2 == 0)
+			continue;
+		const size_t p1 = str.rfind('\t', p2 - 1);
+		if (p1 == string::npos)
+			continue;
+		std::array<size_t, 2> ls = { (size_t)strtoull(&line[p1 + 1], NULL, 10), (size_t)strtoull(&line[p2 + 1], NULL, 10) };
+		results[str.substr(0, p1)] = ls;
+	}
+	fclose(fp);
+}
+
+string oclWGTuner::makeKey(const oclKernel & ker, const size_t(&worksize)[2])
+{
+	//specialized variants share the name but may allow smaller work-groups
+	const string & opts = ker->getBuildOptions();
+	return ker->name + (opts.empty() ? "" : "[" + opts + "]") + "|" + ker->getDevice()->name + "|" + std::to_string(worksize[0]) + "x" + std::to_string(worksize[1]);
+}
+
+void oclWGTuner::save() const
+{
+	FILE *fp;
+	if (fopen_s(&fp, fpath.c_str(), "w") != 0)
+		return;
+	for (const auto & r : results)
+		fprintf(fp, "%s\t%zu\t%zu\n", r.first.c_str(), r.second[0], r.second[1]);
+	fclose(fp);
+}
+
+const size_t * oclWGTuner::getLocalSize(const oclCommandQue cmdQue, const oclKernel ker, const size_t(&worksize)[2])
+{
+	const string key = makeKey(ker, worksize);
+	auto it = results.find(key);
+	if (it == results.end())
+	{
+		//candidates: driver's choice, then every power-of-two shape of multiples of preferred size
+		vector<std::array<size_t, 2>> cands = { { 0,0 } };
+		const size_t maxWG = min(ker->getWorkGroupSize(), (size_t)1024), wgMul = ker->getPreferredWorkGroupMultiple();
+		for (size_t total = max(wgMul, (size_t)16); total <= maxWG; total *= 2)
+		{
+			for (size_t lx = 4; lx <= total; lx *= 2)
+			{
+				const size_t ly = total / lx;
+				if (total % lx == 0 && worksize[0] % lx == 0 && worksize[1] % ly == 0)
+					cands.push_back({ lx, ly });
+			}
+		}
+
+		std::array<size_t, 2> best = { 0,0 };
+		double bestTime = 1e30;
+		//blocking runs on out-of-order queue don't wait for earlier commands, which may use the same buffers
+		if (cmdQue->isOutOfOrder())
+			if (auto evt = cmdQue->barrier())
+				evt->wait();
+		//keep benchmark runs out of profiler totals
+		const auto profiler = cmdQue->profiler;
+		cmdQue->profiler.reset();
+		for (const auto & c : cands)
+		{
+			const size_t * ls = c[0] == 0 ? nullptr : c.data();
+			//warm up, also filters out shapes the device rejects
+			if (!ker->run<2>(cmdQue, worksize, true, { 0,0 }, ls))
+				continue;
+			double minTime = 1e30;
+			for (int a = 0; a < 4; ++a)
+			{
+				const auto t_begin = std::chrono::steady_clock::now();
+				ker->run<2>(cmdQue, worksize, true, { 0,0 }, ls);
+				const auto t_end = std::chrono::steady_clock::now();
+				minTime = min(minTime, std::chrono::duration<double, std::milli>(t_end - t_begin).count());
+			}
+			if (minTime < bestTime)
+				bestTime = minTime, best = c;
+		}
+		cmdQue->profiler = profiler;
+		printf("tuned [%s] : %zux%zu, %.3f ms, %zu candidates\n", key.c_str(), best[0], best[1], bestTime, cands.size());
+		it = results.insert(make_pair(key, best)).first;
+		save();
+	}
+	return it->second[0] == 0 ? nullptr : it->second.data();
+}
+
+
+
+oclRowScheduler::oclRowScheduler(const vector<oclCommandQue> & _queues) : queues(_queues), rates(_queues.size(), 1.0), isMeasured(_queues.size(), false)
+{
+}
+
+vector<oclRowScheduler::Band> oclRowScheduler::split(const size_t rows, const size_t granularity) const
+{
+	vector<Band> bands;
+	double total = 0, acc = 0;
+	for (const double r : rates)
+		total += r;
+	size_t prev = 0;
+	for (size_t a = 0; a < queues.size(); ++a)
+	{
+		acc += rates[a];
+		size_t end = rows;
+		if (a + 1 < queues.size())
+		{
+			end = (size_t)(rows * acc / total / granularity + 0.5) * granularity;
+			end = min(max(end, prev), rows);
+		}
+		if (end > prev)
+			bands.push_back({ a, prev, end - prev });
+		prev = end;
+	}
+	return bands;
+}
+
+void oclRowScheduler::update(const vector<Band> & bands, const oclEventList & evts)
+{
+	for (size_t a = 0; a < bands.size() && a < evts.size(); ++a)
+	{
+		const double t = evts[a] ? evts[a]->getExecTime() : -1.0;
+		if (t <= 0)
+			continue;
+		const size_t idx = bands[a].queIdx;
+		const double rate = bands[a].rows / t;
+		//smooth out frame-to-frame jitter
+		rates[idx] = isMeasured[idx] ? rates[idx] * 0.5 + rate * 0.5 : rate;
+		isMeasured[idx] = true;
+	}
+}
+
 
 
 const char * oclUtil::getErrorString(const cl_int code)
@@ -457,5 +1308,232 @@ const char * oclUtil::getErrorString(const cl_int code)
 }
 
 
+
+oclQueueSet::oclQueueSet(const oclPlatfrom plat, const oclDevice dev, const bool isProfiling, const bool isOutOfOrder)
+{
+	for (auto & q : queues)
+		q = oclUtil::getCommandQueue(plat, dev, isProfiling, isOutOfOrder);
+}
+
+const char * oclQueueSet::getName(const Role role)
+{
+	switch (role)
+	{
+	case Role::Compute:
+		return "compute";
+	case Role::Upload:
+		return "upload";
+	case Role::Download:
+		return "download";
+	default:
+		return "unknown";
+	}
+}
+
+void oclQueueSet::flush()
+{
+	for (auto & q : queues)
+		q->flush();
+}
+
+
+
+
+oclVelStream::oclVelStream(const oclPlatfrom & plat, const oclCommandQue & que, const string & fname, const size_t depth) : cmdQue(que)
+{
+	memset(&header, 0, sizeof(header));
+	hFile = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		printf("cannot open velocity stream %s\n", fname.c_str());
+		return;
+	}
+	LARGE_INTEGER fsize;
+	GetFileSizeEx(hFile, &fsize);
+	const uint64_t fileSize = (uint64_t)fsize.QuadPart;
+	hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMap)
+		base = (const uint8_t *)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+	if (!base)
+	{
+		printf("cannot map velocity stream %s\n", fname.c_str());
+		close();
+		return;
+	}
+	if (fileSize >= sizeof(Header))
+		memcpy(&header, base, sizeof(Header));
+	frameSize = (size_t)header.width * header.height * 2 * sizeof(float);
+	offsets = (const uint64_t *)(base + sizeof(Header));
+	//sim time advances by frameStep every frame, so it must be positive and finite
+	bool isValid = memcmp(header.magic, "VELS", 4) == 0 && header.version == 1 && header.frames > 0 && frameSize > 0
+		&& std::isfinite(header.frameStep) && header.frameStep > 0.0f
+		&& fileSize >= sizeof(Header) + header.frames * sizeof(uint64_t);
+	for (uint32_t a = 0; isValid && a < header.frames; ++a)
+		isValid = offsets[a] <= fileSize && fileSize - offsets[a] >= frameSize;
+	if (!isValid)
+	{
+		printf("invalid velocity stream %s\n", fname.c_str());
+		close();
+		return;
+	}
+
+	for (auto & m : devFrames)
+		m = plat->createMem(_oclMem::Type::ReadOnly, frameSize);
+	slots.resize(max(depth, (size_t)2));
+	for (auto & s : slots)
+	{
+		s.mem = plat->createMem(_oclMem::Type::HostAlloc, frameSize);
+		if (s.mem)
+			s.view = s.mem->map(cmdQue, _oclMem::MapType::WriteInvalidate, 0, frameSize, false);
+	}
+	if (!devFrames[0] || !devFrames[1])
+	{
+		slots.clear();
+		close();
+		return;
+	}
+	cmdQue->flush();
+	worker = std::thread(&oclVelStream::workerLoop, this);
+	printf("velocity stream %s : %u frames of %ux%u, %.3f sim frames per frame, %zu staging slots\n", fname.c_str(),
+		header.frames, header.width, header.height, header.frameStep, slots.size());
+}
+
+oclVelStream::~oclVelStream()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		isQuit = true;
+	}
+	cv.notify_all();
+	if (worker.joinable())
+		worker.join();
+	slots.clear();
+	close();
+}
+
+void oclVelStream::close()
+{
+	if (base)
+		UnmapViewOfFile(base);
+	if (hMap)
+		CloseHandle(hMap);
+	if (hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(hFile);
+	base = nullptr;
+	hMap = NULL;
+	hFile = INVALID_HANDLE_VALUE;
+}
+
+void oclVelStream::workerLoop()
+{
+	const int32_t frames = (int32_t)header.frames, ahead = (int32_t)slots.size();
+	auto isHeld = [&](const int32_t frame)
+	{
+		if (devFrame[0] == frame || devFrame[1] == frame)
+			return true;
+		for (const auto & s : slots)
+			if (s.state != SlotState::Free && s.frame == frame)
+				return true;
+		return false;
+	};
+	//next frame to stage and a slot for it, null when enough frames are ahead or no slot is free
+	auto pick = [&]() -> Slot *
+	{
+		if (distance(fetchFrame) >= ahead)
+			fetchFrame = wantFrame;
+		for (int32_t n = 0; n < ahead && isHeld(fetchFrame); ++n)
+			fetchFrame = (fetchFrame + 1) % frames;
+		if (distance(fetchFrame) >= ahead || isHeld(fetchFrame))
+			return nullptr;
+		for (auto & s : slots)
+			if (s.state == SlotState::Free && s.view)
+				return &s;
+		return nullptr;
+	};
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true)
+	{
+		Slot * slot = nullptr;
+		cv.wait(lock, [&] { return isQuit || (slot = pick()) != nullptr; });
+		if (isQuit)
+			return;
+		slot->state = SlotState::Filling;
+		slot->frame = fetchFrame;
+		fetchFrame = (fetchFrame + 1) % frames;
+		lock.unlock();
+		//page faults of the mapping happen here, off the render thread
+		if (slot->view.getEvent())
+			slot->view.getEvent()->wait();
+		memcpy(slot->view.data(), base + offsets[slot->frame], frameSize);
+		lock.lock();
+		slot->state = SlotState::Filled;
+	}
+}
+
+bool oclVelStream::upload(const int32_t frame, const int32_t keep, const oclEventList & waits)
+{
+	for (auto & s : slots)
+	{
+		if (s.state != SlotState::Filled || s.frame != frame)
+			continue;
+		const int dev = devFrame[0] == keep ? 1 : 0;
+		oclEventList deps = waits;
+		deps.push_back(s.view.unmap());
+		devEvt[dev] = s.mem->copyTo(cmdQue, devFrames[dev], frameSize, deps);
+		devFrame[dev] = frame;
+		//slot goes back to worker, which waits for the map and so for the copy
+		s.view = s.mem->map(cmdQue, _oclMem::MapType::WriteInvalidate, 0, frameSize, false, { devEvt[dev] });
+		s.state = SlotState::Free;
+		s.frame = -1;
+		return true;
+	}
+	return false;
+}
+
+bool oclVelStream::prepare(const double simTime, oclEventList & waits, View & view)
+{
+	if (!isOpen())
+		return false;
+	const int32_t frames = (int32_t)header.frames;
+	const double ft = std::floor(simTime);
+	const int32_t k0 = (int32_t)(((int64_t)ft % frames + frames) % frames), k1 = (k0 + 1) % frames;
+	int i0, i1;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		wantFrame = k0;
+		const oclEventList users = waits;
+		const bool has0 = devFrame[0] == k0 || devFrame[1] == k0 || upload(k0, k1, users);
+		const bool has1 = devFrame[0] == k1 || devFrame[1] == k1 || upload(k1, k0, users);
+		if (!has0 || !has1)
+			misses++;
+		//staged frames behind wanted one will never be used, their slots are still mapped
+		for (auto & s : slots)
+		{
+			if (s.state == SlotState::Filled && distance(s.frame) >= (int32_t)slots.size())
+				s.state = SlotState::Free, s.frame = -1;
+			else if (s.state == SlotState::Free && !s.view && s.mem)
+				s.view = s.mem->map(cmdQue, _oclMem::MapType::WriteInvalidate, 0, frameSize, false);
+		}
+		i0 = devFrame[0] == k0 ? 0 : (devFrame[1] == k0 ? 1 : -1);
+		i1 = devFrame[0] == k1 ? 0 : (devFrame[1] == k1 ? 1 : -1);
+		//missing frames are replaced by whatever is on device
+		if (i0 < 0)
+			i0 = i1 >= 0 ? i1 : (devFrame[0] >= 0 ? 0 : (devFrame[1] >= 0 ? 1 : -1));
+		if (i1 < 0)
+			i1 = i0;
+	}
+	cv.notify_one();
+	cmdQue->flush();
+	if (i0 < 0)
+		return false;
+	view.a = devFrames[i0], view.b = devFrames[i1];
+	view.t = i0 == i1 ? 0.0f : (float)(simTime - ft);
+	for (const auto & e : devEvt)
+		if (e)
+			waits.push_back(e);
+	return true;
+}
+
+
 }
 
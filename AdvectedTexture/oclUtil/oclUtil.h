@@ -7,6 +7,7 @@ namespace oclu
 {
 using std::string;
 using std::vector;
+using std::map;
 using std::shared_ptr;
 using oglu::oglBuffer;
 using oglu::oglTexture;
@@ -20,26 +21,113 @@ class _oclCommandQue;
 using oclCommandQue = shared_ptr<_oclCommandQue>;
 class _oclMem;
 using oclMem = shared_ptr<_oclMem>;
+class _oclMemPool;
+using oclMemPool = shared_ptr<_oclMemPool>;
 class _oclProgram;
 using oclProgram = shared_ptr<_oclProgram>;
 class _oclKernel;
 using oclKernel = shared_ptr<_oclKernel>;
+class _oclEvent;
+using oclEvent = shared_ptr<_oclEvent>;
+using oclEventList = vector<oclEvent>;
+class oclProfiler;
+class oclKernelCache;
+class oclMapView;
 
 class oclUtil
 {
 private:
 	friend class _oclProgram;
 	static vector<oclPlatfrom> plfs;
+	static string binCacheDir;
 	static void init();
 public:
+	//directory to keep built program binaries, empty to disable binary cache
+	static void setBinaryCacheDir(const string & dir);
 	static vector<oclPlatfrom> getPlatforms();
 	static vector<oclPlatfrom> getGLinterOPPlatforms();
-	static oclCommandQue getCommandQueue(const oclPlatfrom);
-	static oclCommandQue getCommandQueue(const oclPlatfrom, const oclDevice);
+	//out-of-order falls back to in-order when device does not support it
+	static oclCommandQue getCommandQueue(const oclPlatfrom, const bool isProfiling = false, const bool isOutOfOrder = false);
+	static oclCommandQue getCommandQueue(const oclPlatfrom, const oclDevice, const bool isProfiling = false, const bool isOutOfOrder = false);
 	static oclKernel getKernel(const oclProgram, const char *);
 	static const char * getErrorString(const cl_int);
 };
 
+class _oclEvent
+{
+private:
+	friend class _oclMem;
+	friend class _oclKernel;
+	friend class oclProfiler;
+	friend class oclMapView;
+	cl_event evt;
+	_oclEvent(const cl_event _evt) : evt(_evt) { };
+	//raw event list for clEnqueue*
+	static vector<cl_event> toList(const oclEventList & evts)
+	{
+		vector<cl_event> ret;
+		for (const auto & e : evts)
+			if (e)
+				ret.push_back(e->evt);
+		return ret;
+	}
+	static oclEvent create(const cl_int ret, const cl_event evt, const bool isBlock)
+	{
+		if (ret != CL_SUCCESS)
+			return oclEvent();
+		oclEvent e(new _oclEvent(evt));
+		if (isBlock)
+			e->wait();
+		return e;
+	}
+public:
+	_oclEvent(const _oclEvent &) = delete;
+	_oclEvent & operator = (const _oclEvent &) = delete;
+	~_oclEvent();
+	void wait() const;
+	bool isFinished() const;
+	//start->end time in ms, needs profiling queue, negative when unavailable
+	double getExecTime() const;
+	static void wait(const oclEventList &);
+};
+
+/*collect device-side timestamps of commands on a profiling queue,
+events are polled without blocking and aggregated by command name*/
+class oclProfiler
+{
+public:
+	struct Stat
+	{
+		uint64_t count = 0;
+		//execution time(start->end) in ms, percentiles are from recent samples
+		double mean = 0, p50 = 0, p99 = 0, min = 0, max = 0;
+		//time held on host side(queued->submit) and waiting on device(submit->start) in ms
+		double meanQueue = 0, meanSubmit = 0;
+	};
+private:
+	struct Record
+	{
+		uint64_t count = 0;
+		double sum = 0, sumQueue = 0, sumSubmit = 0, min = 1e30, max = 0;
+		vector<double> samples;
+		size_t samplePos = 0;
+	};
+	static const size_t maxSamples = 4096;
+	vector<std::pair<string, oclEvent>> pendings;
+	map<string, Record> records;
+	uint32_t dumpInterval;
+	std::chrono::steady_clock::time_point lastDump;
+public:
+	//dump stats every interval ms when collecting, 0 to disable
+	oclProfiler(const uint32_t interval = 0);
+	void setDumpInterval(const uint32_t interval) { dumpInterval = interval; }
+	void record(const string & name, const oclEvent & evt);
+	void collect();
+	map<string, Stat> getStats();
+	void dump();
+	void reset();
+};
+
 class _oclMem
 {
 public:
@@ -48,46 +136,148 @@ public:
 		ReadOnly = CL_MEM_READ_ONLY, WriteOnly = CL_MEM_WRITE_ONLY, ReadWrite = CL_MEM_READ_WRITE,
 		HostUse = CL_MEM_USE_HOST_PTR, HostAlloc = CL_MEM_ALLOC_HOST_PTR, HostCopy = CL_MEM_COPY_HOST_PTR
 	};
+	enum class MapType : cl_map_flags
+	{
+		Read = CL_MAP_READ, Write = CL_MAP_WRITE, WriteInvalidate = CL_MAP_WRITE_INVALIDATE_REGION
+	};
 private:
 	friend class _oclKernel;
 	friend class _oclPlatfrom;
+	friend class _oclMemPool;
 	Type type;
 	bool isGL;
 	cl_mem memID;
 	size_t size;
 	oglBuffer glBuf;
 	oglTexture glTex;
+	//fence of last acquire, kept until next acquire
+	GLsync glFence = nullptr;
+	//sync of last release when GL can wait CL, kept until GL waits it or next release
+	GLsync glRelease = nullptr;
 	_oclMem(const cl_context &, const Type, const size_t);
 	_oclMem(const cl_context &, const Type, const oglBuffer);
 	_oclMem(const cl_context &, const Type, const oglTexture);
 public:
-	bool lock(const oclCommandQue);
-	bool unlock(const oclCommandQue);
-	bool write(const oclCommandQue, const void *, const size_t, const bool isBlock = true);
-	bool read(const oclCommandQue, void *, const size_t, const bool isBlock = true);
+	/*with cl_khr_gl_event, acquire waits on a fence of GL commands issued so far.
+	with GL_ARB_cl_event, unlock keeps a GL sync of the release and glWaitUnlock makes GL wait for it on GPU, so host needn't wait for unlock event.
+	otherwise falls back to glFlush/clFlush and implicit sync*/
+	oclEvent lock(const oclCommandQue, const oclEventList & waits = {});
+	oclEvent unlock(const oclCommandQue, const oclEventList & waits = {});
+	//later GL commands wait for last unlock, call right before GL uses the object so older GL work does not wait
+	void glWaitUnlock();
+	oclEvent write(const oclCommandQue, const void *, const size_t, const bool isBlock = true, const oclEventList & waits = {});
+	oclEvent read(const oclCommandQue, void *, const size_t, const bool isBlock = true, const oclEventList & waits = {});
+	oclEvent read(const oclCommandQue, const size_t offset, void *, const size_t, const bool isBlock = true, const oclEventList & waits = {});
+	//fill whole buffer with a byte, also serves as first touch from the queue's device
+	oclEvent fill(const oclCommandQue, const uint8_t val = 0, const oclEventList & waits = {});
+	//copy to another buffer on device, size 0 copies as much as both buffers hold
+	oclEvent copyTo(const oclCommandQue, const oclMem & dst, const size_t size = 0, const oclEventList & waits = {});
+	//map buffer into host memory, zero-copy for HostAlloc/HostUse buffers on host-visible devices. size 0 maps to the end
+	oclMapView map(const oclCommandQue, const MapType, const size_t offset = 0, const size_t size = 0, const bool isBlock = true, const oclEventList & waits = {});
 	~_oclMem();
 };
 
+/*host view of a mapped buffer, unmapped when destroyed.
+holds a reference of the cl_mem, so buffer outlives the view*/
+class oclMapView
+{
+private:
+	friend class _oclMem;
+	oclCommandQue cmdQue;
+	cl_mem memID = NULL;
+	void * ptr = nullptr;
+	size_t size = 0;
+	oclEvent mapEvt;
+	oclMapView(const oclCommandQue & _cmdQue, const cl_mem _memID, void * _ptr, const size_t _size, const oclEvent & evt);
+public:
+	oclMapView() { };
+	oclMapView(oclMapView && other);
+	oclMapView & operator = (oclMapView && other);
+	oclMapView(const oclMapView &) = delete;
+	oclMapView & operator = (const oclMapView &) = delete;
+	~oclMapView() { unmap(); }
+	explicit operator bool() const { return ptr != nullptr; }
+	void * data() const { return ptr; }
+	template<typename T>
+	T * as() const { return (T*)ptr; }
+	size_t getSize() const { return size; }
+	//map command, wait on it before touching data of a non-blocking map
+	const oclEvent & getEvent() const { return mapEvt; }
+	//hand buffer back to device, later commands using the buffer should wait on returned event
+	oclEvent unmap(const oclEventList & waits = {});
+};
+
 class _oclPlatfrom
 {
 private:
 	friend class _oclProgram;
+	friend class _oclKernel;
 	friend class oclUtil;
-	bool isFirst = true;
+	bool isFirst = true, isMultiDev = false, isNUMASplit = false;
+	//GL/CL sync object support, only for GL interop context
+	clCreateEventFromGLsyncKHR_fn clEventFromGLsync = nullptr;
+	bool canGLWaitCL = false;
 	cl_platform_id pID;
 	cl_device_id defDevID;
-	cl_context context;
+	cl_context context = NULL;
 	vector<oclDevice> devs;
 	oclDevice defDev;
+	//devices of the context, only defDev unless multi-device is enabled
+	vector<cl_device_id> ctxDevIDs;
+	vector<oclDevice> ctxDevs;
 	_oclPlatfrom(const cl_platform_id _pID);
 	void init();
 	void glInit(const cl_context_properties[]);
 public:
 	string name, ver;
 	~_oclPlatfrom();
+	//both create the context if not yet, so enable* calls must come first
+	oclDevice getDefDevice() { init(); return defDev; }
+	vector<oclDevice> getDevices() { init(); return ctxDevs; }
+	//create context over all devices, only valid before context is created
+	bool enableMultiDevice();
+	//replace CPU devices by their NUMA sub-devices in the context, only valid before context is created
+	bool enableNUMASplit();
 	oclMem createMem(const oglBuffer);
 	oclMem createMem(const oglTexture);
 	oclMem createMem(const _oclMem::Type, const size_t);
+	//pool keeps at most highWater bytes of released buffers for reuse
+	oclMemPool createMemPool(const size_t highWater);
+};
+
+/*recycle device buffers by (flags, size class) instead of releasing them,
+buffers from alloc() return to the pool when their last reference is gone.
+size classes are quarter steps between powers of two, so buffer may be up to 25% larger than requested.
+not for HostUse/HostCopy buffers, which need host pointer*/
+class _oclMemPool : public std::enable_shared_from_this<_oclMemPool>
+{
+public:
+	struct Stat
+	{
+		uint64_t hits = 0, misses = 0, trimmed = 0;
+		//bytes kept in pool / bytes handed out
+		size_t bytesHeld = 0, bytesInUse = 0;
+	};
+private:
+	friend class _oclPlatfrom;
+	cl_context context;
+	size_t highWater;
+	map<std::pair<cl_mem_flags, size_t>, vector<_oclMem *>> frees;
+	Stat stat;
+	std::mutex mtx;
+	_oclMemPool(const cl_context _context, const size_t _highWater) : context(_context), highWater(_highWater) { };
+	void recycle(_oclMem * mem);
+	void trimTo(const size_t target);
+public:
+	static size_t getSizeClass(const size_t size);
+	_oclMemPool(const _oclMemPool &) = delete;
+	_oclMemPool & operator = (const _oclMemPool &) = delete;
+	~_oclMemPool();
+	oclMem alloc(const _oclMem::Type, const size_t);
+	void setHighWater(const size_t _highWater);
+	//release pooled buffers until at most target bytes are held
+	void trim(const size_t target = 0);
+	Stat getStat();
 };
 
 class _oclDevice
@@ -97,9 +287,20 @@ private:
 	friend class _oclProgram;
 	friend class oclUtil;
 	cl_device_id dID;
+	bool isSub;
 	_oclDevice(const _oclPlatfrom & _plat, const cl_device_id _dID);
+	_oclDevice(const cl_device_id _dID, const bool _isSub);
 public:
-	string name, vendor, profile;
+	string name, vendor, profile, driver;
+	cl_device_type type;
+	cl_uint floatVecWidth;
+	//device shares memory with host, mapping HostAlloc buffers is zero-copy
+	bool isHostUnified;
+	_oclDevice(const _oclDevice &) = delete;
+	_oclDevice & operator = (const _oclDevice &) = delete;
+	~_oclDevice();
+	//empty when device can't be partitioned into more than one sub-device
+	vector<oclDevice> partitionByAffinity(const cl_device_affinity_domain domain = CL_DEVICE_AFFINITY_DOMAIN_NUMA);
 };
 
 class _oclCommandQue
@@ -108,10 +309,27 @@ private:
 	friend class _oclMem;
 	friend class _oclKernel;
 	friend class oclUtil;
+	friend class oclWGTuner;
 	cl_command_queue cmdQue;
-	_oclCommandQue(const cl_context &, const cl_device_id dID);
+	shared_ptr<oclProfiler> profiler;
+	bool isOOO;
+	cl_context context;
+	clCreateEventFromGLsyncKHR_fn clEventFromGLsync = nullptr;
+	bool canGLWaitCL = false;
+	_oclCommandQue(const cl_context &, const cl_device_id dID, const bool isProfiling, const bool isOutOfOrder);
 public:
 	~_oclCommandQue();
+	void flush();
+	//commands on out-of-order queue are only ordered by their wait lists
+	bool isOutOfOrder() const { return isOOO; }
+	//GL can wait for released GL objects on GPU(by glWaitUnlock), no need to wait unlock event on host
+	bool canGLWaitRelease() const { return canGLWaitCL; }
+	//completes when waits(or all previous commands when empty) complete
+	oclEvent marker(const oclEventList & waits = {});
+	//like marker, and later commands also wait for it
+	oclEvent barrier(const oclEventList & waits = {});
+	//nullptr when queue is created without profiling
+	shared_ptr<oclProfiler> getProfiler() const { return profiler; }
 };
 
 class _oclProgram
@@ -119,13 +337,18 @@ class _oclProgram
 private:
 	friend class _oclMem;
 	friend class _oclKernel;
+	friend class oclKernelCache;
 	oclPlatfrom plat;
-	cl_program program;
-	string src;
+	cl_program program = NULL;
+	string src, options;
+	uint64_t getCacheKey() const;
+	bool loadBinary(const string & fpath, const uint64_t key);
+	void saveBinary(const string & fpath, const uint64_t key);
 public:
 	_oclProgram(const oclPlatfrom _plat);
 	~_oclProgram();
-	bool load(const char * fname, string & msg);
+	bool load(const char * fname, string & msg, const string & _options = "");
+	bool build(const string & _src, string & msg, const string & _options = "");
 };
 
 class _oclKernel
@@ -136,8 +359,15 @@ private:
 	oclProgram clProg;
 	_oclKernel(const oclProgram, const char *);
 public:
+	const string name;
 	~_oclKernel();
+	oclDevice getDevice() const;
+	//options of the program it comes from, tells specialized variants apart
+	const string & getBuildOptions() const { return clProg->options; }
+	size_t getWorkGroupSize() const;
+	size_t getPreferredWorkGroupMultiple() const;
 	bool setArg(const cl_uint, const oclMem);
+	bool setLocalArg(const cl_uint, const size_t);
 	template<typename T>
 	bool setArg(const cl_uint idx, const T & dat)
 	{
@@ -151,22 +381,168 @@ public:
 		return ret == CL_SUCCESS;
 	};
 	template<cl_uint N>
-	bool run(const oclCommandQue cmdQue, const size_t(&worksize)[N], bool isBlock = true, const size_t(&workoffset)[N] = { 0 }, const size_t * localsize = nullptr)
+	oclEvent run(const oclCommandQue cmdQue, const size_t(&worksize)[N], bool isBlock = true, const size_t(&workoffset)[N] = { 0 }, const size_t * localsize = nullptr,
+		const oclEventList & waits = {})
 	{
 		/* Execute OpenCL Kernel */
-		cl_int ret;
-		if (isBlock)
-		{
-			cl_event enentPoint;
-			ret = clEnqueueNDRangeKernel(cmdQue->cmdQue, kernel, N, workoffset, worksize, localsize, 0, NULL, &enentPoint);
-			clWaitForEvents(1, &enentPoint); //wait
-			clReleaseEvent(enentPoint);
-		}
-		else
-			ret = clEnqueueNDRangeKernel(cmdQue->cmdQue, kernel, N, workoffset, worksize, localsize, 0, NULL, NULL);
-		return ret == CL_SUCCESS;
+		const auto evtWaits = _oclEvent::toList(waits);
+		cl_event evt;
+		cl_int ret = clEnqueueNDRangeKernel(cmdQue->cmdQue, kernel, N, workoffset, worksize, localsize,
+			(cl_uint)evtWaits.size(), evtWaits.empty() ? NULL : evtWaits.data(), &evt);
+		oclEvent e = _oclEvent::create(ret, evt, false);
+		if (e && cmdQue->profiler)
+			cmdQue->profiler->record(name, e);
+		if (e && isBlock)
+			e->wait();
+		return e;
 	}
 };
 
 
+/*keep specialized builds of one program source, keyed by build options,
+kernels are cached by (kernel name, build options)*/
+class oclKernelCache
+{
+private:
+	oclProgram baseProg;
+	map<string, oclProgram> progs;
+	map<std::pair<string, string>, oclKernel> kernels;
+public:
+	oclKernelCache(const oclProgram _prog) : baseProg(_prog) { };
+	//empty options returns kernel from base program, nullptr when build fails
+	oclKernel get(const string & kname, const string & options);
+};
+
+
+/*benchmark local sizes of 2D kernels and keep the fastest one for each (kernel, build options, device, global size),
+results are persisted to a text file so later runs skip tuning. tuning launches are not recorded by queue's profiler.
+kernel is run several times with its current arguments, so only kernels that can be safely re-run(no atomics or in-place state) may be tuned*/
+class oclWGTuner
+{
+private:
+	string fpath;
+	//{0,0} means leaving local size to driver
+	map<string, std::array<size_t, 2>> results;
+	static string makeKey(const oclKernel &, const size_t(&worksize)[2]);
+	void save() const;
+public:
+	oclWGTuner(const string & _fpath);
+	/*local size for running the kernel, nullptr for driver's choice.
+	benchmark candidates with current kernel args on first use*/
+	const size_t * getLocalSize(const oclCommandQue, const oclKernel, const size_t(&worksize)[2]);
+};
+
+
+/*split rows of a 2D range across queues in proportion to measured throughput of each queue,
+throughput is re-estimated from execution time of the last frame*/
+class oclRowScheduler
+{
+public:
+	struct Band
+	{
+		size_t queIdx, offset, rows;
+	};
+private:
+	vector<oclCommandQue> queues;
+	//estimated rows per ms of each queue
+	vector<double> rates;
+	vector<bool> isMeasured;
+public:
+	oclRowScheduler(const vector<oclCommandQue> & _queues);
+	const vector<oclCommandQue> & getQueues() const { return queues; }
+	//bands are rounded to granularity rows except the last one
+	vector<Band> split(const size_t rows, const size_t granularity) const;
+	//event of each band, from a profiling queue
+	void update(const vector<Band> & bands, const oclEventList & evts);
+};
+
+
+/*queues of one device in one context by role, so transfers overlap computation.
+commands of different roles are only ordered by events passed as waits*/
+class oclQueueSet
+{
+public:
+	enum class Role : uint8_t { Compute = 0, Upload = 1, Download = 2 };
+private:
+	std::array<oclCommandQue, 3> queues;
+public:
+	oclQueueSet(const oclPlatfrom plat, const oclDevice dev, const bool isProfiling = false, const bool isOutOfOrder = false);
+	const oclCommandQue & get(const Role role) const { return queues[(uint8_t)role]; }
+	const oclCommandQue & operator[](const Role role) const { return get(role); }
+	static const char * getName(const Role role);
+	void flush();
+};
+
+
+/*streams velocity frames of an offline simulation from a memory-mapped file.
+file is Header, then uint64 byte offset of each frame, each frame is width*height float2 in grid cells per sim frame.
+a worker thread copies upcoming frames from the mapping into a ring of mapped HostAlloc staging buffers,
+so page faults and disk reads stay off the render thread, which only unmaps staged slots and enqueues copies to device.
+two device buffers keep the frames around current sim time for interpolation, sim time loops over all frames*/
+class oclVelStream
+{
+public:
+	struct Header
+	{
+		char magic[4];//"VELS"
+		uint32_t version;//1
+		uint32_t width, height, frames;
+		//sim frames advanced per rendered frame, below 1 when sim is stored at lower rate
+		float frameStep;
+	};
+	//frames around requested time, velocity is mix(a, b, t)
+	struct View
+	{
+		oclMem a, b;
+		float t;
+	};
+private:
+	enum class SlotState : uint8_t { Free, Filling, Filled };
+	struct Slot
+	{
+		oclMem mem;
+		oclMapView view;
+		int32_t frame = -1;
+		SlotState state = SlotState::Free;
+	};
+	HANDLE hFile = INVALID_HANDLE_VALUE, hMap = NULL;
+	const uint8_t * base = nullptr;
+	Header header;
+	const uint64_t * offsets = nullptr;
+	size_t frameSize = 0;
+	oclCommandQue cmdQue;
+	vector<Slot> slots;
+	oclMem devFrames[2];
+	int32_t devFrame[2]{ -1, -1 };
+	oclEvent devEvt[2];
+	//worker fetches from fetchFrame on, render thread moves wantFrame
+	int32_t fetchFrame = 0, wantFrame = 0;
+	uint64_t misses = 0;
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool isQuit = false;
+	void close();
+	void workerLoop();
+	//frames ahead of wantFrame, in loop order
+	int32_t distance(const int32_t frame) const { return (frame - wantFrame + (int32_t)header.frames) % (int32_t)header.frames; }
+	//upload staged frame into a device buffer not holding keep, false when frame is not staged yet
+	bool upload(const int32_t frame, const int32_t keep, const oclEventList & waits);
+public:
+	//depth is number of staging slots, i.e. how many frames are prefetched
+	oclVelStream(const oclPlatfrom & plat, const oclCommandQue & que, const string & fname, const size_t depth = 4);
+	oclVelStream(const oclVelStream &) = delete;
+	oclVelStream & operator = (const oclVelStream &) = delete;
+	~oclVelStream();
+	bool isOpen() const { return base != nullptr; }
+	const Header & getHeader() const { return header; }
+	//frames needed but not staged in time, the previous frames were used instead
+	uint64_t getMissCount() const { return misses; }
+	/*make frames around simTime resident on device without waiting for disk.
+	copies wait for waits(last users of device buffers), their events are appended to it.
+	false when no frame is on device yet*/
+	bool prepare(const double simTime, oclEventList & waits, View & view);
+};
+
+
 }
\ No newline at end of file
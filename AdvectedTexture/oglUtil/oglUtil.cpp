@@ -5,7 +5,7 @@ namespace oglu
 using std::forward;
 using glm::vec3;
 
-oglShader::oglShader(const Type type, const char * fpath) : shaderType(type)
+oglShader::oglShader(const Type type, const char * fpath, const string & prefix) : shaderType(type)
 {
 	FILE * fp;
 	if (fopen_s(&fp, fpath, "rb") != 0)
@@ -19,12 +19,18 @@ oglShader::oglShader(const Type type, const char * fpath) : shaderType(type)
 	fread(dat, fsize, 1, fp);
 	dat[fsize] = '\0';
 	src.assign(dat);
+	delete[] dat;
+	if (!prefix.empty())
+	{
+		const size_t pos = src.find('\n');
+		src.insert(pos == string::npos ? src.size() : pos + 1, prefix);
+	}
 
 	fclose(fp);
 
 	shaderID = glCreateShader(GLenum(type));
-	glShaderSource(shaderID, 1, &dat, NULL);
-	delete[] dat;
+	const char * csrc = src.c_str();
+	glShaderSource(shaderID, 1, &csrc, NULL);
 }
 
 oglShader::~oglShader()
@@ -192,12 +198,12 @@ void _oglTexture::parseFormat(const Format format, GLint & intertype, GLenum & d
 	switch (format)
 	{
 	case Format::RGB:
-		intertype = GL_RGB;
+		intertype = GL_RGB8;
 		datatype = GL_UNSIGNED_BYTE;
 		comptype = GL_RGB;
 		break;
 	case Format::RGBA:
-		intertype = GL_RGBA;
+		intertype = GL_RGBA8;
 		datatype = GL_UNSIGNED_BYTE;
 		comptype = GL_RGBA;
 		break;
@@ -211,6 +217,21 @@ void _oglTexture::parseFormat(const Format format, GLint & intertype, GLenum & d
 		datatype = GL_FLOAT;
 		comptype = GL_RGBA;
 		break;
+	case Format::R:
+		intertype = GL_R8;
+		datatype = GL_UNSIGNED_BYTE;
+		comptype = GL_RED;
+		break;
+	case Format::Rh:
+		intertype = GL_R16F;
+		datatype = GL_HALF_FLOAT;
+		comptype = GL_RED;
+		break;
+	case Format::Rf:
+		intertype = GL_R32F;
+		datatype = GL_FLOAT;
+		comptype = GL_RED;
+		break;
 	}
 }
 
@@ -224,30 +245,92 @@ _oglTexture::~_oglTexture()
 	glDeleteTextures(1, &tID);
 }
 
-void _oglTexture::setData(const Format format, const GLsizei w, const GLsizei h, const void * data)
+void _oglTexture::allocate(const Format format, const GLsizei w, const GLsizei h)
 {
-	glBindTexture((GLenum)type, tID);
+	if (isAllocated && format == curFormat && w == width && h == height)
+		return;
+	if (isAllocated)
+	{
+		//replace texture object, keep its parameters
+		GLint params[4];
+		glBindTexture((GLenum)type, tID);
+		glGetTexParameteriv((GLenum)type, GL_TEXTURE_WRAP_S, &params[0]);
+		glGetTexParameteriv((GLenum)type, GL_TEXTURE_WRAP_T, &params[1]);
+		glGetTexParameteriv((GLenum)type, GL_TEXTURE_MAG_FILTER, &params[2]);
+		glGetTexParameteriv((GLenum)type, GL_TEXTURE_MIN_FILTER, &params[3]);
+		glDeleteTextures(1, &tID);
+		glGenTextures(1, &tID);
+		glBindTexture((GLenum)type, tID);
+		glTexParameteri((GLenum)type, GL_TEXTURE_WRAP_S, params[0]);
+		glTexParameteri((GLenum)type, GL_TEXTURE_WRAP_T, params[1]);
+		glTexParameteri((GLenum)type, GL_TEXTURE_MAG_FILTER, params[2]);
+		glTexParameteri((GLenum)type, GL_TEXTURE_MIN_FILTER, params[3]);
+	}
+	else
+		glBindTexture((GLenum)type, tID);
 
 	GLint intertype;
 	GLenum datatype, comptype;
 	parseFormat(format, intertype, datatype, comptype);
-	glTexImage2D((GLenum)type, 0, intertype, w, h, 0, comptype, datatype, data);
+	glTexStorage2D((GLenum)type, 1, intertype, w, h);
+	isAllocated = true;
+	curFormat = format;
+	width = w, height = h;
 	//glBindTexture((GLenum)type, 0);
 }
 
+void _oglTexture::setData(const Format format, const GLsizei w, const GLsizei h, const void * data)
+{
+	allocate(format, w, h);
+	setSubData(0, 0, w, h, data);
+}
+
 void _oglTexture::setData(const Format format, const GLsizei w, const GLsizei h, const oglBuffer buf)
 {
+	allocate(format, w, h);
+	setSubData(0, 0, w, h, buf);
+}
+
+void _oglTexture::setSubData(const GLint x, const GLint y, const GLsizei w, const GLsizei h, const void * data)
+{
+	if (!isAllocated)
+		return;
+	glBindTexture((GLenum)type, tID);
+
+	GLint intertype;
+	GLenum datatype, comptype;
+	parseFormat(curFormat, intertype, datatype, comptype);
+	glTexSubImage2D((GLenum)type, 0, x, y, w, h, comptype, datatype, data);
+	//glBindTexture((GLenum)type, 0);
+}
+
+void _oglTexture::setSubData(const GLint x, const GLint y, const GLsizei w, const GLsizei h, const oglBuffer buf, const size_t offset, const GLint rowLength)
+{
+	if (!isAllocated)
+		return;
 	glBindTexture((GLenum)type, tID);
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buf->bID);
+	if (rowLength)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
 
 	GLint intertype;
 	GLenum datatype, comptype;
-	parseFormat(format, intertype, datatype, comptype);
-	glTexImage2D((GLenum)type, 0, intertype, w, h, 0, comptype, datatype, NULL);
+	parseFormat(curFormat, intertype, datatype, comptype);
+	glTexSubImage2D((GLenum)type, 0, x, y, w, h, comptype, datatype, (const void *)offset);
 
+	if (rowLength)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 	//glBindTexture((GLenum)type, 0);
 }
 
+void _oglTexture::bindImage(const GLuint unit, const GLenum access)
+{
+	GLint intertype;
+	GLenum datatype, comptype;
+	parseFormat(curFormat, intertype, datatype, comptype);
+	glBindImageTexture(unit, tID, 0, GL_FALSE, 0, access, (GLenum)intertype);
+}
+
 
 }
\ No newline at end of file
@@ -36,7 +36,8 @@ private:
 	GLuint shaderID = 0;
 	string src;
 public:
-	oglShader(const Type, const char *);
+	//prefix is inserted after #version line, for defines
+	oglShader(const Type, const char * fpath, const string & prefix = "");
 	oglShader(const oglShader &) = delete;
 	oglShader & operator = (const oglShader &) = delete;
 	oglShader(oglShader &&) = default;
@@ -116,7 +117,8 @@ public:
 	enum class Type : GLenum { Tex2D = GL_TEXTURE_2D, };
 	enum class Format : GLenum
 	{
-		RGB = GL_RGB, RGBA = GL_RGBA, RGBf = GL_RGB32F, RGBAf = GL_RGBA32F
+		RGB = GL_RGB, RGBA = GL_RGBA, RGBf = GL_RGB32F, RGBAf = GL_RGBA32F,
+		R = GL_R8, Rh = GL_R16F, Rf = GL_R32F
 	};
 	enum class PropType { Wrap, Filter };
 	enum class PropVal : GLint
@@ -128,6 +130,10 @@ private:
 	friend class oglVAO;
 	friend class oclu::_oclMem;
 	Type type;
+	//immutable storage allocated by glTexStorage2D
+	bool isAllocated = false;
+	Format curFormat;
+	GLsizei width = 0, height = 0;
 	void parseFormat(const Format format, GLint & intertype, GLenum & datatype, GLenum & comptype);
 	void _setProperty() { };
 	template <class... T>
@@ -143,8 +149,22 @@ public:
 		_setProperty(args...);
 		glBindTexture((GLenum)type, 0);
 	}
+	/*allocate immutable storage, only re-allocate when size or format changes.
+	immutable storage can't be re-specified, so tID changes then, objects sharing the texture should be re-created*/
+	void allocate(const Format format, const GLsizei w, const GLsizei h);
+	//allocate when needed and update whole texture
 	void setData(const Format format, const GLsizei w, const GLsizei h, const void *);
 	void setData(const Format format, const GLsizei w, const GLsizei h, const oglBuffer);
+	//update a rectangle of allocated storage
+	void setSubData(const GLint x, const GLint y, const GLsizei w, const GLsizei h, const void *);
+	/*update a rectangle from PBO, data starts at offset bytes.
+	rowLength is pixels per row in PBO, 0 means rows are tightly packed*/
+	void setSubData(const GLint x, const GLint y, const GLsizei w, const GLsizei h, const oglBuffer, const size_t offset = 0, const GLint rowLength = 0);
+	GLsizei getWidth() const { return width; }
+	GLsizei getHeight() const { return height; }
+	Format getFormat() const { return curFormat; }
+	//bind level 0 to image unit for imageLoad/imageStore, access is GL_READ_ONLY/GL_WRITE_ONLY/GL_READ_WRITE
+	void bindImage(const GLuint unit, const GLenum access);
 };
 using oglTexture = shared_ptr<_oglTexture>;
 
@@ -4,6 +4,7 @@
 #include <intrin.h>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 #include <locale>
 #include <cmath>
 #include <string>
@@ -7,6 +7,32 @@ float getNoise(int x, int y)
 }
 
 
+//output formats of noise kernels, must match OutFormat table in main.cpp
+#define FMT_RGBA32F 0
+#define FMT_R32F 1
+#define FMT_R16F 2
+#define FMT_R8 3
+
+void storeVal(global void * dst, const int id, const float val, const int fmt)
+{
+	switch (fmt)
+	{
+	case FMT_R32F:
+		((global float *)dst)[id] = val;
+		break;
+	case FMT_R16F:
+		vstore_half(val, id, (global half *)dst);
+		break;
+	case FMT_R8:
+		((global uchar *)dst)[id] = convert_uchar_sat_rte(val * 255.0f);
+		break;
+	default:
+		((global float4 *)dst)[id] = (float4)(val, val, val, 1.0f);
+		break;
+	}
+}
+
+
 kernel void genColorful(global write_only float4 * dat)
 {
 	const int idx = get_global_id(0),
@@ -22,21 +48,40 @@ kernel void genColorful(global write_only float4 * dat)
 }
 
 
-float InterCosine(const float x0, const float x1, const float w)
+//compile-time specialization, set through program build options:
+//LEVEL fixes octave count of multi-octave kernels(runtime level argument is then ignored),
+//INTERP selects interpolation, 0 = cosine(default), 1 = linear, 2 = smoothstep
+#ifdef LEVEL
+#    define OCT_COUNT LEVEL
+#    define OCT_AMP (1.0f / (1 << LEVEL))
+#else
+#    define OCT_COUNT level
+#    define OCT_AMP (1 / pown(2.0f, level))
+#endif
+#ifndef INTERP
+#    define INTERP 0
+#endif
+//INTER_DW is derivative of INTER_W
+#if INTERP == 1
+#    define INTER_W(t) (t)
+#    define INTER_DW(t) 1.0f
+#elif INTERP == 2
+#    define INTER_W(t) ((t) * (t) * (3.0f - 2.0f * (t)))
+#    define INTER_DW(t) (6.0f * (t) * (1.0f - (t)))
+#else
+#    define INTER_W(t) (0.5f - cospi(t) * 0.5f)
+#    define INTER_DW(t) (sinpi(t) * (M_PI_F * 0.5f))
+#endif
+
+float InterNoise(const float x0, const float x1, const float w)
 {
-	const float f = 0.5f - cospi(w) * 0.5f;
-	return mix(x0, x1, f);
+	return mix(x0, x1, INTER_W(w));
 }
 
 
-kernel void genStepNoise(int level, global write_only float4 * dst)
+//noise value of one pixel, shared by buffer and image kernels
+float stepNoiseAt(const int level, const int idx, const int idy)
 {
-	const int idx = get_global_id(0),
-		idy = get_global_id(1),
-		w = get_global_size(0),
-		h = get_global_size(1);
-	const int id = mad24(idy, w, idx);
-	
 	const float stp = pown(0.5f, level);
 	const float rx = idx * stp, ry = idy * stp;
 	const int x0 = floor(rx), y0 = floor(ry),
@@ -49,24 +94,15 @@ kernel void genStepNoise(int level, global write_only float4 * dst)
 		wy = mad(cospi(ry - y0), -0.5f, 0.5f);
 	const float w0 = mix(w00, w10, wx),
 		w1 = mix(w01, w11, wx);
-
-	const float val = mix(w0, w1, wy);
-	dst[id] = (float4)(val, val, val, 1.0f);
+	return mix(w0, w1, wy);
 }
 
-
-kernel void genMultiNoise(int level, global write_only float4 * dst)
+float multiNoiseAt(const int level, const int idx, const int idy)
 {
-	const int idx = get_global_id(0),
-		idy = get_global_id(1),
-		w = get_global_size(0),
-		h = get_global_size(1);
-	const int id = mad24(idy, w, idx);
-
 	float val = 0.0f;
 	float stp = 1.0f;
-	float amp = 1 / pown(2.0f, level);
-	for (int a = level; a-- > 0; amp *= 2, stp *= 0.5f)
+	float amp = OCT_AMP;
+	for (int a = OCT_COUNT; a-- > 0; amp *= 2, stp *= 0.5f)
 	{
 		float rx = idx * stp, ry = idy * stp;
 		const int x0 = floor(rx), y0 = floor(ry),
@@ -77,11 +113,58 @@ kernel void genMultiNoise(int level, global write_only float4 * dst)
 			w01 = getNoise(x0, y1),
 			w11 = getNoise(x1, y1);
 		rx -= x0, ry -= y0;
-		const float w0 = InterCosine(w00, w10, rx),
-			w1 = InterCosine(w01, w11, rx);
-		val += InterCosine(w0, w1, ry) * amp;
+		const float w0 = InterNoise(w00, w10, rx),
+			w1 = InterNoise(w01, w11, rx);
+		val += InterNoise(w0, w1, ry) * amp;
+	}
+	return val;
+}
+
+//w is row pitch of src
+float multiNoiseFromBase(const int level, global const float * src, const int w, const int idx, const int idy)
+{
+	float val = 0.0f;
+	float stp = 1.0f;
+	float amp = OCT_AMP;
+	for (int a = OCT_COUNT; a-- > 0; amp *= 2, stp *= 0.5f)
+	{
+		const float rx = idx * stp, ry = idy * stp;
+		const int x0 = floor(rx), y0 = floor(ry),
+			x1 = ceil(rx), y1 = ceil(ry);
+		const int base = mad24(y0, w, x0);
+		const float w00 = src[base],
+			w10 = src[base + 1],
+			w01 = src[base + w],
+			w11 = src[base + w + 1];
+		const float wx = INTER_W(rx - x0),
+			wy = INTER_W(ry - y0);
+		const float w0 = mix(w00, w10, wx),
+			w1 = mix(w01, w11, wx);
+		val += mix(w0, w1, wy) * amp;
 	}
-	dst[id] = (float4)(val, val, val, 1.0f);
+	return val;
+}
+
+
+kernel void genStepNoise(int level, global write_only void * dst, const int fmt)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0),
+		h = get_global_size(1);
+	const int id = mad24(idy, w, idx);
+	storeVal(dst, id, stepNoiseAt(level, idx, idy), fmt);
+}
+
+
+kernel void genMultiNoise(int level, global write_only void * dst, const int fmt)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0),
+		h = get_global_size(1);
+	const int id = mad24(idy, w, idx);
+	storeVal(dst, id, multiNoiseAt(level, idx, idy), fmt);
 }
 
 kernel void genNoiseBase(global write_only float * src)
@@ -95,32 +178,419 @@ kernel void genNoiseBase(global write_only float * src)
 }
 
 
-kernel void genNoiseMulti(int level, global read_only float * src, global write_only float4 * dst)
+kernel void genNoiseMulti(int level, global read_only float * src, global write_only void * dst, const int fmt)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0),
+		h = get_global_size(1);
+	const int id = mad24(idy, w, idx);
+	storeVal(dst, id, multiNoiseFromBase(level, src, w, idx, idy), fmt);
+}
+
+kernel void genNoiseMultiTiled(int level, global read_only float * src, local float * tile, global write_only void * dst, const int fmt)
 {
 	const int idx = get_global_id(0),
 		idy = get_global_id(1),
 		w = get_global_size(0),
 		h = get_global_size(1);
 	const int id = mad24(idy, w, idx);
+	const int lx = get_local_id(0), ly = get_local_id(1),
+		lw = get_local_size(0), lh = get_local_size(1);
+	const int gx = idx - lx, gy = idy - ly;
+	//tile holds (lw+1)*(lh+1) lattice cells, enough for the finest octave
+	const int tw = lw + 1;
 
 	float val = 0.0f;
 	float stp = 1.0f;
-	float amp = 1 / pown(2.0f, level);
-	for (int a = level; a-- > 0; amp *= 2, stp *= 0.5f)
+	float amp = OCT_AMP;
+	for (int a = OCT_COUNT; a-- > 0; amp *= 2, stp *= 0.5f)
 	{
+		//lattice cells covered by this work-group at current octave
+		const int bx = floor(gx * stp), by = floor(gy * stp);
+		const int nx = (int)floor((gx + lw - 1) * stp) - bx + 2,
+			ny = (int)floor((gy + lh - 1) * stp) - by + 2;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int ty = ly; ty < ny; ty += lh)
+			for (int tx = lx; tx < nx; tx += lw)
+				tile[mad24(ty, tw, tx)] = src[mad24(min(by + ty, h - 1), w, min(bx + tx, w - 1))];
+		barrier(CLK_LOCAL_MEM_FENCE);
+
 		const float rx = idx * stp, ry = idy * stp;
-		const int x0 = floor(rx), y0 = floor(ry),
-			x1 = ceil(rx), y1 = ceil(ry);
-		const int base = mad24(y0, w, x0);
-		const float w00 = src[base],
-			w10 = src[base + 1],
-			w01 = src[base + w],
-			w11 = src[base + w + 1];
-		const float wx = mad(cospi(rx - x0), -0.5f, 0.5f),
-			wy = mad(cospi(ry - y0), -0.5f, 0.5f);
+		const int x0 = floor(rx), y0 = floor(ry);
+		const int base = mad24(y0 - by, tw, x0 - bx);
+		const float w00 = tile[base],
+			w10 = tile[base + 1],
+			w01 = tile[base + tw],
+			w11 = tile[base + tw + 1];
+		const float wx = INTER_W(rx - x0),
+			wy = INTER_W(ry - y0);
 		const float w0 = mix(w00, w10, wx),
 			w1 = mix(w01, w11, wx);
 		val += mix(w0, w1, wy) * amp;
 	}
-	dst[id] = (float4)(val, val, val, 1.0f);
-}
\ No newline at end of file
+	storeVal(dst, id, val, fmt);
+}
+
+
+//image variants write the shared GL texture directly, conversion to texture format is done by image unit
+kernel void genColorfulImg(write_only image2d_t dst)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		sizex = get_global_size(0),
+		sizey = get_global_size(1);
+
+	float pstep = (idx + idy) * 1.0f / (sizex + sizey);
+	write_imagef(dst, (int2)(idx, idy), (float4)(idx * 1.0f / sizex, idy * 1.0f / sizey, pstep, 1.0f));
+}
+
+kernel void genStepNoiseImg(int level, write_only image2d_t dst)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1);
+	const float val = stepNoiseAt(level, idx, idy);
+	write_imagef(dst, (int2)(idx, idy), (float4)(val, val, val, 1.0f));
+}
+
+kernel void genMultiNoiseImg(int level, write_only image2d_t dst)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1);
+	const float val = multiNoiseAt(level, idx, idy);
+	write_imagef(dst, (int2)(idx, idy), (float4)(val, val, val, 1.0f));
+}
+
+kernel void genNoiseMultiImg(int level, global read_only float * src, write_only image2d_t dst)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0);
+	const float val = multiNoiseFromBase(level, src, w, idx, idy);
+	write_imagef(dst, (int2)(idx, idy), (float4)(val, val, val, 1.0f));
+}
+
+
+//run-of-N variants: each work-item produces N horizontally adjacent pixels,
+//lattice hashes of a row are computed once for the whole run and shuffled to each pixel
+#define IOTA_4 (int4)(0, 1, 2, 3)
+#define IOTA_8 (int8)(0, 1, 2, 3, 4, 5, 6, 7)
+#define IOTA_16 (int16)(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+#define DEF_NOISE_RUN(N) \
+float##N getNoise##N(const int##N x, const int y) \
+{ \
+	const uint##N n = as_uint##N(mad24((int##N)(y), (int##N)(58), x) + mad24(x, (int##N)(4093), (int##N)(y))); \
+	return convert_float##N(mad24(n, mad24(n, n * 15731u, (uint##N)(789221u)), (uint##N)(1376312589u))) / 4294967296.0f; \
+} \
+ \
+void getLatticeRun##N(const int##N x0, const int##N x1, const int y0, const int y1, \
+	float##N * w00, float##N * w10, float##N * w01, float##N * w11) \
+{ \
+	const int bx = x0.s0; \
+	const int##N cx = bx + IOTA_##N; \
+	const float##N h0 = getNoise##N(cx, y0), h1 = getNoise##N(cx, y1); \
+	const float##N h0n = (float##N)(getNoise(bx + N, y0)), h1n = (float##N)(getNoise(bx + N, y1)); \
+	const uint##N m0 = as_uint##N(x0 - bx), m1 = as_uint##N(x1 - bx); \
+	*w00 = shuffle(h0, m0); \
+	*w10 = shuffle2(h0, h0n, m1); \
+	*w01 = shuffle(h1, m0); \
+	*w11 = shuffle2(h1, h1n, m1); \
+} \
+ \
+void storeVal##N(global void * dst, const int id, const float##N val, const int fmt) \
+{ \
+	switch (fmt) \
+	{ \
+	case FMT_R32F: \
+		vstore##N(val, 0, (global float *)dst + id); \
+		break; \
+	case FMT_R16F: \
+		vstore_half##N(val, 0, (global half *)dst + id); \
+		break; \
+	case FMT_R8: \
+		vstore##N(convert_uchar##N##_sat_rte(val * 255.0f), 0, (global uchar *)dst + id); \
+		break; \
+	default: \
+		{ \
+			float tmp[N]; \
+			vstore##N(val, 0, tmp); \
+			for (int i = 0; i < N; ++i) \
+				((global float4 *)dst)[id + i] = (float4)(tmp[i], tmp[i], tmp[i], 1.0f); \
+		} \
+		break; \
+	} \
+} \
+ \
+kernel void genStepNoise##N(int level, global write_only void * dst, const int fmt) \
+{ \
+	const int idx = get_global_id(0) * N, \
+		idy = get_global_id(1), \
+		w = get_global_size(0) * N; \
+	const int id = mad24(idy, w, idx); \
+ \
+	const float stp = pown(0.5f, level); \
+	const float##N rx = convert_float##N(idx + IOTA_##N) * stp; \
+	const float ry = idy * stp; \
+	const int##N x0 = convert_int##N(floor(rx)), x1 = convert_int##N(ceil(rx)); \
+	const int y0 = floor(ry), y1 = ceil(ry); \
+	float##N w00, w10, w01, w11; \
+	getLatticeRun##N(x0, x1, y0, y1, &w00, &w10, &w01, &w11); \
+	const float##N wx = mad(cospi(rx - convert_float##N(x0)), (float##N)(-0.5f), (float##N)(0.5f)); \
+	const float wy = mad(cospi(ry - y0), -0.5f, 0.5f); \
+	const float##N w0 = mix(w00, w10, wx), \
+		w1 = mix(w01, w11, wx); \
+ \
+	storeVal##N(dst, id, mix(w0, w1, wy), fmt); \
+} \
+ \
+kernel void genMultiNoise##N(int level, global write_only void * dst, const int fmt) \
+{ \
+	const int idx = get_global_id(0) * N, \
+		idy = get_global_id(1), \
+		w = get_global_size(0) * N; \
+	const int id = mad24(idy, w, idx); \
+	const float##N fidx = convert_float##N(idx + IOTA_##N); \
+ \
+	float##N val = 0.0f; \
+	float stp = 1.0f; \
+	float amp = OCT_AMP; \
+	for (int a = OCT_COUNT; a-- > 0; amp *= 2, stp *= 0.5f) \
+	{ \
+		const float##N rx = fidx * stp; \
+		const float ry = idy * stp; \
+		const int##N x0 = convert_int##N(floor(rx)), x1 = convert_int##N(ceil(rx)); \
+		const int y0 = floor(ry), y1 = ceil(ry); \
+		float##N w00, w10, w01, w11; \
+		getLatticeRun##N(x0, x1, y0, y1, &w00, &w10, &w01, &w11); \
+		const float##N fx = INTER_W(rx - convert_float##N(x0)); \
+		const float fy = INTER_W(ry - y0); \
+		const float##N w0 = mix(w00, w10, fx), \
+			w1 = mix(w01, w11, fx); \
+		val += mix(w0, w1, fy) * amp; \
+	} \
+	storeVal##N(dst, id, val, fmt); \
+}
+
+DEF_NOISE_RUN(4)
+DEF_NOISE_RUN(8)
+DEF_NOISE_RUN(16)
+
+
+//gradient of multi-octave value noise, derivative of each octave is taken analytically from its interpolation
+float2 noiseGradAt(const int level, const int idx, const int idy)
+{
+	float2 grad = 0.0f;
+	float stp = 1.0f;
+	float amp = 1 / pown(2.0f, level);
+	for (int a = level; a-- > 0; amp *= 2, stp *= 0.5f)
+	{
+		const float rx = idx * stp, ry = idy * stp;
+		//next lattice point even when exactly on one, differences are needed for slope
+		const int x0 = floor(rx), y0 = floor(ry),
+			x1 = x0 + 1, y1 = y0 + 1;
+		const float w00 = getNoise(x0, y0),
+			w10 = getNoise(x1, y0),
+			w01 = getNoise(x0, y1),
+			w11 = getNoise(x1, y1);
+		const float tx = rx - x0, ty = ry - y0;
+		const float dx = INTER_DW(tx) * mix(w10 - w00, w11 - w01, INTER_W(ty)),
+			dy = INTER_DW(ty) * mix(w01 - w00, w11 - w10, INTER_W(tx));
+		grad += (float2)(dx, dy) * (amp * stp);
+	}
+	return grad;
+}
+
+/*divergence-free velocity as curl of multi-octave noise used as stream function, one vector per cell.
+stream function evolves by blending two noise slices picked by phase, slices repeat every 1024 steps.
+scaled by period of coarsest octave so strength is roughly the speed in pixels per frame*/
+kernel void genCurlField(const int level, const float phase, const float strength, global write_only float2 * vel)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0);
+	const int id = mad24(idy, w, idx);
+	const int slice = (int)floor(phase);
+	const float t = phase - slice;
+	const int s0 = (slice & 1023) * 977, s1 = ((slice + 1) & 1023) * 977;
+	const float2 g = mix(noiseGradAt(level, idx + s0, idy), noiseGradAt(level, idx + s1, idy), t);
+	vel[id] = (strength * pown(2.0f, level - 1)) * (float2)(g.y, -g.x);
+}
+
+//bilinear fetch with wrap-around, so content leaving one side enters from the other
+float sampleWrap(global const float * src, const int w, const int h, const float2 pos)
+{
+	const float2 fp = floor(pos);
+	const float2 t = pos - fp;
+	const int x0 = (int)fp.x, y0 = (int)fp.y;
+	const int xa = ((x0 % w) + w) % w, ya = ((y0 % h) + h) % h;
+	const int xb = xa + 1 == w ? 0 : xa + 1, yb = ya + 1 == h ? 0 : ya + 1;
+	const float w0 = mix(src[mad24(ya, w, xa)], src[mad24(ya, w, xb)], t.x),
+		w1 = mix(src[mad24(yb, w, xa)], src[mad24(yb, w, xb)], t.x);
+	return mix(w0, w1, t.y);
+}
+
+//bilinear fetch of a gw*gh vector grid with clamp to edge, pos in grid cells
+float2 sampleGrid2(global const float2 * grid, const int gw, const int gh, const float2 pos)
+{
+	const float2 p = clamp(pos, (float2)(0.0f), (float2)(gw - 1, gh - 1));
+	const float2 fp = floor(p);
+	const float2 t = p - fp;
+	const int x0 = (int)fp.x, y0 = (int)fp.y,
+		x1 = min(x0 + 1, gw - 1), y1 = min(y0 + 1, gh - 1);
+	const float2 v0 = mix(grid[mad24(y0, gw, x0)], grid[mad24(y0, gw, x1)], t.x),
+		v1 = mix(grid[mad24(y1, gw, x0)], grid[mad24(y1, gw, x1)], t.x);
+	return mix(v0, v1, t.y);
+}
+
+//velocity of a pixel from field of one vector per down*down pixels
+float2 sampleVel(global const float2 * vel, const int down, const int w, const int h, const int idx, const int idy)
+{
+	const int vw = (w + down - 1) / down, vh = (h + down - 1) / down;
+	return sampleGrid2(vel, vw, vh, ((float2)(idx, idy) + 0.5f) / down - 0.5f);
+}
+
+/*velocity grid from two streamed sim frames of sw*sh, mixed by t and resampled.
+scale turns grid cells per sim frame into pixels per rendered frame*/
+kernel void resampleVel(global read_only float2 * a, global read_only float2 * b, const float t, const int sw, const int sh,
+	const float2 scale, global write_only float2 * vel)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0),
+		h = get_global_size(1);
+	const int id = mad24(idy, w, idx);
+	const float2 pos = ((float2)(idx, idy) + 0.5f) * (float2)(sw, sh) / (float2)(w, h) - 0.5f;
+	vel[id] = mix(sampleGrid2(a, sw, sh, pos), sampleGrid2(b, sw, sh, pos), t) * scale;
+}
+
+//semi-Lagrangian step: value at each pixel comes from where it was dt frames ago.
+//state is the float field fed to next step, dst gets the same value in output format
+kernel void advect(global read_only float * src, global read_only float2 * vel, const int down, const float dt,
+	global write_only float * state, global write_only void * dst, const int fmt)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0),
+		h = get_global_size(1);
+	const int id = mad24(idy, w, idx);
+	const float2 pos = (float2)(idx, idy) - sampleVel(vel, down, w, h, idx, idy) * dt;
+	const float val = sampleWrap(src, w, h, pos);
+	state[id] = val;
+	storeVal(dst, id, val, fmt);
+}
+
+/*fresh noise of given layer into slot of dst holding w*h fields back to back, each layer at its own offset so layers are uncorrelated.
+may be launched over a band of rows with global offset, so a layer can be built over several frames*/
+kernel void genLayerNoise(int level, const int layer, const int h, const int slot, global write_only float * dst)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0);
+	dst[mad24(mad24(slot, h, idy), w, idx)] = multiNoiseAt(level, idx + layer * 4096, idy + layer * 4096);
+}
+
+/*advect several layers stored one after another in src and blend them into dst.
+layers in regenMask restart from fresh instead, which genLayerNoise has built before.
+weights are already divided by sqrt of their square sum, so blending keeps contrast around mean 0.5*/
+kernel void advectLayers(global read_only float * src, global read_only float2 * vel, const int down, const float dt,
+	const int layers, const int regenMask, global read_only float * fresh, const float4 weights, global write_only float * state,
+	global write_only void * dst, const int fmt)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0),
+		h = get_global_size(1);
+	const int id = mad24(idy, w, idx);
+	const float2 pos = (float2)(idx, idy) - sampleVel(vel, down, w, h, idx, idy) * dt;
+	float val = 0.5f;
+	for (int l = 0; l < layers; ++l)
+	{
+		const int off = l * w * h;
+		const float lv = (regenMask >> l) & 1 ? fresh[id] : sampleWrap(src + off, w, h, pos);
+		state[off + id] = lv;
+		const float wt = l == 0 ? weights.x : (l == 1 ? weights.y : (l == 2 ? weights.z : weights.w));
+		val += wt * (lv - 0.5f);
+	}
+	storeVal(dst, id, val, fmt);
+}
+
+
+//sparse advection works on ADV_TILE*ADV_TILE pixel tiles, must match AdvTile in main.cpp
+#define ADV_TILE 16
+
+/*list tiles whose velocity moves pixels by more than threshold, plus tiles that were active last frame.
+latter ones get top bit set and are only copied, so both ping-pong buffers agree before the tile goes idle.
+one work-item per tile, velocity cells around the tile are included since sampling is bilinear*/
+kernel void classifyTiles(global read_only float2 * vel, const int down, const int w, const int h, const float threshold,
+	global uchar * wasActive, global uint * count, global write_only uint * list)
+{
+	const int tx = get_global_id(0),
+		ty = get_global_id(1),
+		tw = get_global_size(0);
+	const int tile = mad24(ty, tw, tx);
+	const int vw = (w + down - 1) / down, vh = (h + down - 1) / down;
+	const int cx0 = max(tx * ADV_TILE / down - 1, 0), cy0 = max(ty * ADV_TILE / down - 1, 0),
+		cx1 = min((tx + 1) * ADV_TILE / down, vw - 1), cy1 = min((ty + 1) * ADV_TILE / down, vh - 1);
+	float maxV2 = 0.0f;
+	for (int cy = cy0; cy <= cy1; ++cy)
+		for (int cx = cx0; cx <= cx1; ++cx)
+		{
+			const float2 v = vel[mad24(cy, vw, cx)];
+			maxV2 = max(maxV2, dot(v, v));
+		}
+	const bool isActive = maxV2 > threshold * threshold;
+	const bool wasAct = wasActive[tile] != 0;
+	wasActive[tile] = isActive ? 1 : 0;
+	if (isActive || wasAct)
+		list[atomic_inc(count)] = tile | (isActive ? 0u : 0x80000000u);
+}
+
+/*advect(and restart layers in regenMask from fresh) only tiles in list, one ADV_TILE*ADV_TILE work-group per list slot.
+launched over all tiles, groups past count return at once. pixels of other tiles are not written*/
+kernel void advectTiles(global read_only float * src, global read_only float2 * vel, const int down, const float dt,
+	const int w, const int h, const int layers, const int regenMask, global read_only float * fresh, global read_only uint * list,
+	global read_only uint * count, global write_only float * state)
+{
+	const uint slot = get_group_id(1);
+	if (slot >= *count)
+		return;
+	const uint entry = list[slot];
+	const int tile = entry & 0x7fffffff, tw = w / ADV_TILE;
+	const int idx = mad24(tile % tw, ADV_TILE, (int)get_local_id(0)),
+		idy = mad24(tile / tw, ADV_TILE, (int)get_local_id(1));
+	const int id = mad24(idy, w, idx);
+	if (entry >> 31)
+	{
+		for (int l = 0; l < layers; ++l)
+			state[l * w * h + id] = src[l * w * h + id];
+		return;
+	}
+	const float2 pos = (float2)(idx, idy) - sampleVel(vel, down, w, h, idx, idy) * dt;
+	for (int l = 0; l < layers; ++l)
+	{
+		const int off = l * w * h;
+		state[off + id] = (regenMask >> l) & 1 ? fresh[id] : sampleWrap(src + off, w, h, pos);
+	}
+}
+
+//output of advection state, single field is stored as is, layers are blended like advectLayers does
+kernel void storeLayers(global read_only float * state, const int layers, const float4 weights, global write_only void * dst, const int fmt)
+{
+	const int idx = get_global_id(0),
+		idy = get_global_id(1),
+		w = get_global_size(0),
+		h = get_global_size(1);
+	const int id = mad24(idy, w, idx);
+	float val = state[id];
+	if (layers > 1)
+	{
+		val = 0.5f;
+		for (int l = 0; l < layers; ++l)
+		{
+			const float wt = l == 0 ? weights.x : (l == 1 ? weights.y : (l == 2 ? weights.z : weights.w));
+			val += wt * (state[l * w * h + id] - 0.5f);
+		}
+	}
+	storeVal(dst, id, val, fmt);
+}